@@ -1,9 +1,15 @@
+#include <chrono>
+#include <fstream>
 #include <iostream>
-#include "rhash.hpp"
+#include "rolling_hash.hpp"
 #include "diff.hpp"
 #include <map>
 #include "cxxopts.hpp"
 #include "file_reader.hpp"
+#include "block_size_tuner.hpp"
+#include "patched_view.hpp"
+#include "trace.hpp"
+#include "batch.hpp"
 
 static bool overwritePrompt(const std::string &file_path) {
     std::string input;
@@ -17,13 +23,112 @@ static bool overwritePrompt(const std::string &file_path) {
 }
 
 
+static uint32_t autoBlockSize(const std::string &file_path, const cxxopts::ParseResult &result) {
+    if (!io::FileReader::doesFileExist(file_path)) {
+        throw std::invalid_argument(std::string("File " + file_path + " doesn't exist or broken!"));
+    }
+
+    diff::BlockSizeTuner tuner(std::filesystem::file_size(file_path));
+
+    if (result.count("tune-sample")) {
+        auto sample = result["tune-sample"].as<std::vector<std::string>>();
+        if (sample.size() != 2) {
+            throw std::invalid_argument("Tune sample needs signature and delta paths!");
+        }
+        diff::Diff d;
+        d.getSignatureFromFile(sample[0]);
+        d.getDeltaFromFile(sample[1]);
+        tuner.sampleChanges(d.signature(), d.delta());
+    }
+
+    diff::BlockSizeEstimate estimate = tuner.tune();
+    std::cout << "Block size: " << estimate.block_size
+              << " (predicted signature " << estimate.signature_bytes << " B, delta " << estimate.delta_bytes
+              << " B, cpu " << estimate.cpu_cost << " B, total " << estimate.total() << " B)" << std::endl;
+
+    return estimate.block_size;
+}
+
+// Runs every manifest item, prints status of each as it finishes and aggregate throughput. Returns failed count.
+static size_t runBatchManifest(const std::string &manifest_path, const diff::BatchOptions &options) {
+    std::ifstream manifest(manifest_path);
+    if (!manifest) {
+        throw std::invalid_argument(std::string("Manifest " + manifest_path + " can't be read!"));
+    }
+    std::vector<diff::BatchItem> items = diff::parseManifest(manifest);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<diff::BatchResult> results = diff::runBatch(items, options,
+            [](const diff::BatchItem &item, const diff::BatchResult &result) {
+        std::cout << (result.ok ? "ok   " : "FAIL ") << item.line << " " << diff::batchOpName(item.op) << " "
+                  << item.output;
+        if (result.ok) {
+            std::cout << " (" << result.bytes_read << " B in, " << result.bytes_written << " B out, "
+                      << result.wall_ns / 1000 << " us)" << std::endl;
+        } else {
+            std::cout << ": " << result.error << std::endl;
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failed = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    // throughput counts only items that finished
+    for (const auto &result : results) {
+        if (!result.ok) {
+            failed++;
+            continue;
+        }
+        bytes_read += result.bytes_read;
+        bytes_written += result.bytes_written;
+    }
+    double mib_read = static_cast<double>(bytes_read) / (1 << 20);
+    std::cout << "Batch: " << items.size() << " items, " << failed << " failed, " << bytes_read << " B in, "
+              << bytes_written << " B out, " << seconds << " s, "
+              << (seconds > 0 ? mib_read / seconds : 0) << " MiB/s, "
+              << (seconds > 0 ? static_cast<double>(items.size()) / seconds : 0) << " items/s" << std::endl;
+    return failed;
+}
+
+// "begin-end" byte ranges (end exclusive) and block indexes of the patched file
+static std::vector<diff::ByteRange> outputRanges(const cxxopts::ParseResult &result, uint32_t block_size) {
+    std::vector<diff::ByteRange> ranges;
+    if (result.count("range")) {
+        for (const auto &range : result["range"].as<std::vector<std::string>>()) {
+            auto separator = range.find('-');
+            if (separator == std::string::npos) {
+                throw std::invalid_argument(std::string("Range " + range + " isn't <begin>-<end>!"));
+            }
+            uint64_t begin = std::stoull(range.substr(0, separator));
+            uint64_t end = std::stoull(range.substr(separator + 1));
+            if (end < begin) {
+                throw std::invalid_argument(std::string("Range " + range + " ends before it begins!"));
+            }
+            ranges.push_back({begin, end - begin});
+        }
+    }
+    if (result.count("blocks")) {
+        for (auto index : result["blocks"].as<std::vector<uint64_t>>()) {
+            if (index > UINT64_MAX / block_size) {
+                throw std::invalid_argument(std::string("Block " + std::to_string(index) + " is out of range!"));
+            }
+            ranges.push_back({index * block_size, block_size});
+        }
+    }
+    return ranges;
+}
+
 int main(int argc, char* argv[]) {
 
     bool force = false;
     bool sha = false;
     std::string output_path;
     std::string file_path;
-    uint16_t block_size = 0;
+    uint32_t block_size = 0;
+    RollingHashType rolling_hash = RollingHashType::Adler;
+    diff::Compression compression = diff::Compression::None;
+    io::Chunking chunking = io::Chunking::Fixed;
 
     cxxopts::Options options(argv[0], "Application for diffing files - cli options:");
     options
@@ -38,6 +143,12 @@ int main(int argc, char* argv[]) {
             ("s,signature", "Create signature file", cxxopts::value<std::string>(), "<base_file_path> {-o <out>} [-x | -f]")
             ("d,delta", "Create delta file", cxxopts::value<std::string>(), "<signature_path> {-i <new> | -o <out>} [-x | -f]")
             ("p,patch", "Patch file",cxxopts::value<std::string>(), "<base_file_path> {-i <delta> | -o <out>} [-x | -f]")
+            ("compose", "Compose chain of deltas into one delta against the first base", cxxopts::value<std::vector<std::string>>(),
+                    "<delta1>,<delta2>,... {-o <out>} [-i <base>]")
+            ("diff", "Create delta file directly from base and new file", cxxopts::value<std::string>(),
+                    "<base_file_path> {-i <new> | -o <out>} [-x | -f]")
+            ("batch", "Run manifest of items \"<signature | delta | patch | diff> <input>... <output>\" in parallel",
+                    cxxopts::value<std::string>(), "<manifest_path> [-t <threads>] [--io-budget <MiB>]")
             ("h,help", "Print help");
 
     options
@@ -51,8 +162,33 @@ int main(int argc, char* argv[]) {
         .add_options("more")
             ("x,sha", "Enable sha hashing")
             ("f,force", "Force output overwrite")
-            ("b,block-size", "Block size to hash (not recommended!)", cxxopts::value<uint16_t>(),
-                    "<decimal>");
+            ("b,block-size", "Block size to hash (not recommended!)", cxxopts::value<uint32_t>(),
+                    "<decimal>")
+            ("r,rolling-hash", "Rolling hash used for signature", cxxopts::value<std::string>(),
+                    "<adler | rabin-karp | buzhash>")
+            ("c,cdc", "Content defined chunking instead of fixed blocks")
+            ("a,auto-block", "Tune block size to file size and report predicted cost")
+            ("e,extend", "Extend delta matches byte by byte against local base file", cxxopts::value<std::string>(),
+                    "<base_file_path>")
+            ("tune-sample", "Previous signature and delta used by auto block size", cxxopts::value<std::vector<std::string>>(),
+                    "<signature>,<delta>")
+            ("z,compress", "Compress delta literals (default best codec of this build)",
+                    cxxopts::value<std::string>()->implicit_value("auto"), "<auto | zlib | zstd | none>")
+            ("range", "Patch only given byte ranges of new file into sparse output", cxxopts::value<std::vector<std::string>>(),
+                    "<begin>-<end>,...")
+            ("blocks", "Patch only given blocks (delta block size, 4096 for direct delta) into sparse output",
+                    cxxopts::value<std::vector<uint64_t>>(), "<index>,...")
+            ("reverse", "Write reverse delta (patched -> base) while patching", cxxopts::value<std::string>(),
+                    "<reverse_delta_path>")
+            ("base-dict", "Compress literals with neighbouring base data as dictionary (needs base: --diff or -e)")
+            ("t,threads", "Threads used to index base file by direct diff or to run batch (default all cores)",
+                    cxxopts::value<unsigned>()->default_value("0"), "<decimal>")
+            ("stats", "Print counters, time per phase and peak memory of the run",
+                    cxxopts::value<std::string>()->implicit_value("text"), "<text | json>")
+            ("trace", "Record Chrome trace (chrome://tracing, Perfetto) of the run", cxxopts::value<std::string>(),
+                    "<trace_json_path>")
+            ("io-budget", "Input MiB read by all batch workers at once, larger item runs alone",
+                    cxxopts::value<uint64_t>()->default_value("256"), "<decimal>");
 
     options.parse_positional({"input", "output"});
     auto result = options.parse(argc, argv);
@@ -72,8 +208,36 @@ int main(int argc, char* argv[]) {
         force = true;
     }
 
+    if (result.count("cdc")){
+        chunking = io::Chunking::ContentDefined;
+    }
+
     if (result.count("block-size")){
-        block_size = result["block-size"].as<uint16_t>();
+        block_size = result["block-size"].as<uint32_t>();
+    }
+
+    if (result.count("batch")) {
+        size_t failed = 0;
+        try {
+            diff::BatchOptions batch_options;
+            batch_options.threads = result["threads"].as<unsigned>();
+            batch_options.io_budget = result["io-budget"].as<uint64_t>() << 20;
+            batch_options.sha = sha;
+            batch_options.force = force;
+            batch_options.block_size = block_size;
+            batch_options.chunking = chunking;
+            if (result.count("rolling-hash")) {
+                batch_options.rolling_hash = rollingHashFromString(result["rolling-hash"].as<std::string>());
+            }
+            if (result.count("compress")) {
+                batch_options.compression = diff::compressionFromString(result["compress"].as<std::string>());
+            }
+            failed = runBatchManifest(result["batch"].as<std::string>(), batch_options);
+        } catch (std::invalid_argument &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return failed > 0 ? 1 : 0;
     }
 
     if (result.count("output")){
@@ -90,39 +254,155 @@ int main(int argc, char* argv[]) {
     }
 
     try {
+        auto start = std::chrono::steady_clock::now();
+        diff::Stats run_stats;
+        diff::Stats *stats = nullptr;
+        if (result.count("stats")) {
+            auto format = result["stats"].as<std::string>();
+            if (format != "text" && format != "json") {
+                throw std::invalid_argument(std::string("Unknown stats format " + format + "!"));
+            }
+            stats = &run_stats;
+        }
+
+        if (result.count("trace")) {
+#ifdef JDIFF_WITH_TRACE
+            diff::Tracer::instance().start(result["trace"].as<std::string>());
+#else
+            throw std::invalid_argument("Tracing is disabled in this build, configure with -DJDIFF_TRACE=ON!");
+#endif
+        }
+
+        if (result.count("rolling-hash")){
+            rolling_hash = rollingHashFromString(result["rolling-hash"].as<std::string>());
+        }
+
+        if (result.count("compress")){
+            compression = diff::compressionFromString(result["compress"].as<std::string>());
+        } else if (result.count("base-dict")){
+            compression = diff::defaultCompression();
+        }
+
         if (result.count("patch")) {
             diff::Diff d;
             if (file_path.empty()) {
                 goto FinishHelp;
             }
             std::string base_file_path = result["patch"].as<std::string>();
-            d.getDeltaFromFile(file_path);
-            io::FileReader reader(base_file_path, d.delta().block_size);
+            io::FileReader dictionary_reader(base_file_path);
+            d.setStats(stats);
+            d.getDeltaFromFile(file_path, &dictionary_reader);
+            io::FileReader reader(base_file_path, d.delta().block_size, d.delta().chunking);
+            reader.setStats(stats);
             io::FileWriter writer(output_path);
-            diff::Diff::patchFile(d.delta(), reader, writer, sha);
+            if (result.count("range") || result.count("blocks")) {
+                if (sha && !diff::Diff::compareSha(d.delta().sha, diff::Diff::calculateFileSha256(base_file_path))) {
+                    throw std::invalid_argument("Delta hash doesn't match to the base file!");
+                }
+                uint32_t block_size = d.delta().block_size > 0 ? d.delta().block_size : 4096;
+                diff::PatchedView view(d.delta(), reader, std::filesystem::file_size(base_file_path));
+                view.writeRanges(outputRanges(result, block_size), writer);
+            } else if (result.count("reverse")) {
+                diff::Delta reverse;
+                diff::Diff::patchFile(d.delta(), reader, writer, sha, {}, &reverse);
+                reverse.compression = compression;
+                io::FileWriter reverse_writer(result["reverse"].as<std::string>());
+                reverse_writer.append(reverse.serialize());
+            } else {
+                diff::Diff::patchFile(d.delta(), reader, writer, sha);
+            }
+        } else if (result.count("compose")) {
+            auto delta_paths = result["compose"].as<std::vector<std::string>>();
+            // base is read only for block math of the first delta and its base dictionary literals
+            std::unique_ptr<io::FileReader> base_reader;
+            uint64_t base_size = 0;
+            if (!file_path.empty()) {
+                base_reader = std::make_unique<io::FileReader>(file_path);
+                base_size = std::filesystem::file_size(file_path);
+            }
+
+            std::vector<diff::Delta> deltas;
+            for (size_t i = 0; i < delta_paths.size(); i++) {
+                diff::Diff loader;
+                loader.setStats(stats);
+                loader.getDeltaFromFile(delta_paths[i], i == 0 ? base_reader.get() : nullptr);
+                deltas.push_back(loader.delta());
+            }
+            if (!deltas.empty() && deltas.front().format == diff::DeltaFormat::Blocks && !base_reader) {
+                throw std::invalid_argument("First delta is block delta, its base is needed: -i <base>!");
+            }
+
+            diff::Diff d;
+            d.setStats(stats);
+            d.composeDeltas(deltas, base_size);
+            d.generateDeltaFile(output_path, compression);
+        } else if (result.count("diff")) {
+            diff::Diff d;
+            if (file_path.empty()) {
+                goto FinishHelp;
+            }
+            io::FileReader base_reader(result["diff"].as<std::string>());
+            io::FileReader reader(file_path);
+            d.setStats(stats);
+            base_reader.setStats(stats);
+            reader.setStats(stats);
+            d.prepareDirectDelta(base_reader, reader, sha, result["threads"].as<unsigned>());
+            io::FileReader dictionary_reader(result["diff"].as<std::string>());
+            d.generateDeltaFile(output_path, compression, result.count("base-dict") ? &dictionary_reader : nullptr);
         } else if (result.count("delta")) {
             diff::Diff d;
             if (file_path.empty()) {
                 goto FinishHelp;
             }
             std::string signature_file = result["delta"].as<std::string>();
+            d.setStats(stats);
             d.getSignatureFromFile(signature_file);
-            io::FileReader reader(file_path, d.signature().block_size);
+            // mapped input lets the byte loop of delta run without virtual calls
+            io::MmapReader reader(file_path, d.signature().block_size, d.signature().chunking);
+            reader.setStats(stats);
             d.prepareDelta(d.signature(), reader, sha);
-            d.generateDeltaFile(output_path);
+            std::unique_ptr<io::FileReader> dictionary_reader;
+            if (result.count("extend")) {
+                io::FileReader base_reader(result["extend"].as<std::string>(), d.delta().block_size);
+                base_reader.setStats(stats);
+                d.extendMatches(base_reader);
+                if (result.count("base-dict")) {
+                    dictionary_reader = std::make_unique<io::FileReader>(result["extend"].as<std::string>());
+                }
+            } else if (result.count("base-dict")) {
+                throw std::invalid_argument("Base dictionary needs base file, use -e <base>!");
+            }
+            d.generateDeltaFile(output_path, compression, dictionary_reader.get());
 
         } else if (result.count("signature")) {
             std::string base_file_path = result["signature"].as<std::string>();
             diff::Diff d;
-            io::FileReader reader(base_file_path, block_size);
-            d.prepareSignatures(reader, sha);
+            if (result.count("auto-block")) {
+                block_size = autoBlockSize(base_file_path, result);
+            }
+            io::MmapReader reader(base_file_path, block_size, chunking);
+            d.setStats(stats);
+            reader.setStats(stats);
+            d.prepareSignatures(reader, sha, rolling_hash);
             d.generateSignatureFile(output_path);
         } else {
             goto FinishHelp;
         }
+
+        if (stats) {
+            auto wall_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+            if (result["stats"].as<std::string>() == "json") {
+                stats->printJson(std::cout, wall_ns);
+            } else {
+                stats->print(std::cout, wall_ns);
+            }
+        }
     } catch (std::invalid_argument &e){
         std::cerr << "Error: " << e.what() << std::endl;
     }
+    // failed run is written too, the trace shows how far it got
+    diff::Tracer::instance().stop();
 
 
     return 0;
@@ -0,0 +1,137 @@
+//
+// Minimal benchmark harness: every case runs warm-up iterations, then timed repetitions. Reports
+// percentiles of time per repetition and throughput of the bytes one repetition processes.
+//
+
+#ifndef JDIFF_BENCH_HARNESS_HPP
+#define JDIFF_BENCH_HARNESS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+    struct Result {
+        std::string name;
+        uint64_t bytes = 0;
+        uint32_t repetitions = 0;
+        double min_ns = 0;
+        double mean_ns = 0;
+        double p50_ns = 0;
+        double p90_ns = 0;
+        double p99_ns = 0;
+
+        // throughput at median time
+        double bytesPerSecond() const {
+            return p50_ns > 0 ? static_cast<double>(bytes) * 1e9 / p50_ns : 0;
+        }
+    };
+
+    // Keeps the optimizer from dropping results of measured code
+    template<typename T>
+    inline void doNotOptimize(const T &value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    class Harness {
+    public:
+        Harness(uint32_t warmup, uint32_t repetitions, std::string filter)
+                : warmup_(warmup), repetitions_(std::max<uint32_t>(1, repetitions)), filter_(std::move(filter)) {}
+
+        // body runs once per repetition and processes bytes bytes, setup (not timed) runs before each of them
+        void run(const std::string &name, uint64_t bytes, const std::function<void()> &body,
+                 const std::function<void()> &setup = {}) {
+            if (!filter_.empty() && name.find(filter_) == std::string::npos) {
+                return;
+            }
+
+            for (uint32_t i = 0; i < warmup_; i++) {
+                if (setup) setup();
+                body();
+            }
+
+            std::vector<double> samples;
+            samples.reserve(repetitions_);
+            for (uint32_t i = 0; i < repetitions_; i++) {
+                if (setup) setup();
+                auto start = std::chrono::steady_clock::now();
+                body();
+                auto stop = std::chrono::steady_clock::now();
+                samples.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+            }
+            std::sort(samples.begin(), samples.end());
+
+            Result result;
+            result.name = name;
+            result.bytes = bytes;
+            result.repetitions = repetitions_;
+            result.min_ns = samples.front();
+            double sum = 0;
+            for (double sample : samples) sum += sample;
+            result.mean_ns = sum / static_cast<double>(samples.size());
+            result.p50_ns = percentile(samples, 0.50);
+            result.p90_ns = percentile(samples, 0.90);
+            result.p99_ns = percentile(samples, 0.99);
+            results_.push_back(result);
+        }
+
+        const std::vector<Result> & results() const { return results_; }
+
+        void printTable(std::ostream &os) const {
+            os << std::left << std::setw(34) << "benchmark" << std::right << std::setw(12) << "bytes"
+               << std::setw(14) << "p50_us" << std::setw(14) << "p90_us" << std::setw(14) << "p99_us"
+               << std::setw(14) << "MB/s" << std::endl;
+            for (const auto &result : results_) {
+                os << std::left << std::setw(34) << result.name << std::right << std::setw(12) << result.bytes
+                   << std::fixed << std::setprecision(2)
+                   << std::setw(14) << result.p50_ns / 1e3 << std::setw(14) << result.p90_ns / 1e3
+                   << std::setw(14) << result.p99_ns / 1e3 << std::setw(14) << result.bytesPerSecond() / 1e6
+                   << std::endl;
+            }
+        }
+
+        void printJson(std::ostream &os) const {
+            os << "{\"benchmarks\": [";
+            for (size_t i = 0; i < results_.size(); i++) {
+                const auto &result = results_[i];
+                os << (i ? ",\n  " : "\n  ") << std::fixed << std::setprecision(1)
+                   << "{\"name\": \"" << result.name << "\", \"bytes\": " << result.bytes
+                   << ", \"repetitions\": " << result.repetitions << ", \"min_ns\": " << result.min_ns
+                   << ", \"mean_ns\": " << result.mean_ns << ", \"p50_ns\": " << result.p50_ns
+                   << ", \"p90_ns\": " << result.p90_ns << ", \"p99_ns\": " << result.p99_ns
+                   << ", \"bytes_per_second\": " << result.bytesPerSecond() << "}";
+            }
+            os << "\n]}" << std::endl;
+        }
+
+        void printCsv(std::ostream &os) const {
+            os << "name,bytes,repetitions,min_ns,mean_ns,p50_ns,p90_ns,p99_ns,bytes_per_second" << std::endl;
+            for (const auto &result : results_) {
+                os << std::fixed << std::setprecision(1) << result.name << "," << result.bytes << ","
+                   << result.repetitions << "," << result.min_ns << "," << result.mean_ns << ","
+                   << result.p50_ns << "," << result.p90_ns << "," << result.p99_ns << ","
+                   << result.bytesPerSecond() << std::endl;
+            }
+        }
+
+    private:
+        // nearest rank on sorted samples
+        static double percentile(const std::vector<double> &sorted, double fraction) {
+            auto rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+            return sorted[std::min(rank, sorted.size() - 1)];
+        }
+
+        uint32_t warmup_;
+        uint32_t repetitions_;
+        std::string filter_;
+        std::vector<Result> results_;
+    };
+}
+
+#endif //JDIFF_BENCH_HARNESS_HPP
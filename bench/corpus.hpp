@@ -0,0 +1,210 @@
+//
+// Synthetic corpus for end-to-end benchmarks: base files of typical content kinds and controlled
+// mutations of them. Everything is derived from a seed, so the same scenario is reproducible.
+//
+
+#ifndef JDIFF_BENCH_CORPUS_HPP
+#define JDIFF_BENCH_CORPUS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+    enum class BaseKind {
+        Random,
+        Text,
+        Zero,
+        VmImage
+    };
+
+    enum class Mutation {
+        Edit,
+        Insert,
+        Delete,
+        Move,
+        Append,
+        Truncate
+    };
+
+    inline BaseKind baseKindFromString(const std::string &name) {
+        if (name == "random") return BaseKind::Random;
+        if (name == "text") return BaseKind::Text;
+        if (name == "zero") return BaseKind::Zero;
+        if (name == "vm") return BaseKind::VmImage;
+        throw std::invalid_argument(std::string("Unknown base kind " + name + "!"));
+    }
+
+    inline std::string baseKindName(BaseKind kind) {
+        switch (kind) {
+            case BaseKind::Random: return "random";
+            case BaseKind::Text: return "text";
+            case BaseKind::Zero: return "zero";
+            case BaseKind::VmImage: return "vm";
+        }
+        return "";
+    }
+
+    inline Mutation mutationFromString(const std::string &name) {
+        if (name == "edit") return Mutation::Edit;
+        if (name == "insert") return Mutation::Insert;
+        if (name == "delete") return Mutation::Delete;
+        if (name == "move") return Mutation::Move;
+        if (name == "append") return Mutation::Append;
+        if (name == "truncate") return Mutation::Truncate;
+        throw std::invalid_argument(std::string("Unknown mutation " + name + "!"));
+    }
+
+    inline std::string mutationName(Mutation mutation) {
+        switch (mutation) {
+            case Mutation::Edit: return "edit";
+            case Mutation::Insert: return "insert";
+            case Mutation::Delete: return "delete";
+            case Mutation::Move: return "move";
+            case Mutation::Append: return "append";
+            case Mutation::Truncate: return "truncate";
+        }
+        return "";
+    }
+
+    class Corpus {
+    public:
+        explicit Corpus(uint64_t seed) : random_(seed) {}
+
+        std::vector<unsigned char> generate(BaseKind kind, size_t size) {
+            std::vector<unsigned char> data;
+            data.reserve(size);
+            switch (kind) {
+                case BaseKind::Random:
+                    appendRandom(data, size);
+                    break;
+                case BaseKind::Text:
+                    appendText(data, size);
+                    break;
+                case BaseKind::Zero:
+                    // sparse file: mostly zeros with scattered data islands
+                    while (data.size() < size) {
+                        size_t run = std::min(size - data.size(), uniform(1, 16) * s_page_size);
+                        data.insert(data.end(), run, 0);
+                        appendRandom(data, std::min(size - data.size(), uniform(64, s_page_size)));
+                    }
+                    break;
+                case BaseKind::VmImage:
+                    // disk image pages: free (zero), duplicated (shared libraries), binary and text
+                    while (data.size() < size) {
+                        size_t page = std::min(size - data.size(), s_page_size);
+                        uint64_t roll = uniform(0, 9);
+                        if (roll < 4) {
+                            data.insert(data.end(), page, 0);
+                        } else if (roll < 6 && data.size() >= s_page_size) {
+                            size_t source = uniform(0, data.size() / s_page_size - 1) * s_page_size;
+                            data.insert(data.end(), data.begin() + static_cast<long>(source),
+                                        data.begin() + static_cast<long>(source + page));
+                        } else if (roll < 8) {
+                            appendRandom(data, page);
+                        } else {
+                            appendText(data, data.size() + page);
+                        }
+                    }
+                    break;
+            }
+            data.resize(size);
+            return data;
+        }
+
+        // Applies count mutations of given type, sizes are relative to the data so scenarios scale
+        void mutate(std::vector<unsigned char> &data, Mutation mutation, uint32_t count) {
+            size_t span = std::max<size_t>(1, data.size() / 256);
+            for (uint32_t i = 0; i < count && !data.empty(); i++) {
+                switch (mutation) {
+                    case Mutation::Edit: {
+                        size_t offset = uniform(0, data.size() - 1);
+                        size_t length = std::min(data.size() - offset, uniform(1, 16));
+                        for (size_t j = 0; j < length; j++) {
+                            data[offset + j] = static_cast<unsigned char>(uniform(0, 255));
+                        }
+                        break;
+                    }
+                    case Mutation::Insert: {
+                        std::vector<unsigned char> inserted;
+                        appendRandom(inserted, uniform(1, s_page_size));
+                        data.insert(data.begin() + static_cast<long>(uniform(0, data.size())), inserted.begin(),
+                                    inserted.end());
+                        break;
+                    }
+                    case Mutation::Delete: {
+                        size_t offset = uniform(0, data.size() - 1);
+                        size_t length = std::min(data.size() - offset, uniform(1, s_page_size));
+                        data.erase(data.begin() + static_cast<long>(offset),
+                                   data.begin() + static_cast<long>(offset + length));
+                        break;
+                    }
+                    case Mutation::Move: {
+                        size_t length = std::min(data.size(), span);
+                        size_t offset = uniform(0, data.size() - length);
+                        std::vector<unsigned char> moved(data.begin() + static_cast<long>(offset),
+                                                         data.begin() + static_cast<long>(offset + length));
+                        data.erase(data.begin() + static_cast<long>(offset),
+                                   data.begin() + static_cast<long>(offset + length));
+                        data.insert(data.begin() + static_cast<long>(uniform(0, data.size())), moved.begin(),
+                                    moved.end());
+                        break;
+                    }
+                    case Mutation::Append:
+                        appendRandom(data, span);
+                        break;
+                    case Mutation::Truncate:
+                        data.resize(data.size() - std::min(data.size() - 1, span));
+                        break;
+                }
+            }
+        }
+
+    private:
+        uint64_t uniform(uint64_t min, uint64_t max) {
+            return std::uniform_int_distribution<uint64_t>(min, max)(random_);
+        }
+
+        void appendRandom(std::vector<unsigned char> &data, size_t size) {
+            for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+                uint64_t value = random_();
+                for (size_t j = 0; j < sizeof(uint64_t) && i + j < size; j++) {
+                    data.push_back(static_cast<unsigned char>(value >> (8 * j)));
+                }
+            }
+        }
+
+        // Words of a small vocabulary with skewed frequencies, lines end at random widths
+        void appendText(std::vector<unsigned char> &data, size_t end) {
+            static const char *s_words[] = {"the", "of", "and", "delta", "signature", "block", "rolling", "hash",
+                                            "file", "patch", "base", "new", "return", "const", "uint64_t", "if",
+                                            "for", "while", "std::vector", "offset", "size", "length", "data"};
+            static constexpr size_t s_word_count = sizeof(s_words) / sizeof(s_words[0]);
+            size_t line = 0;
+            while (data.size() < end) {
+                // squared uniform favours the first words like natural language does
+                uint64_t roll = uniform(0, s_word_count - 1);
+                const char *word = s_words[roll * roll / s_word_count];
+                for (const char *c = word; *c && data.size() < end; c++) {
+                    data.push_back(static_cast<unsigned char>(*c));
+                }
+                line += std::char_traits<char>::length(word) + 1;
+                if (data.size() < end) {
+                    bool newline = line > uniform(40, 100);
+                    data.push_back(newline ? '\n' : ' ');
+                    if (newline) line = 0;
+                }
+            }
+        }
+
+        static constexpr inline size_t s_page_size = 4096;
+
+        std::mt19937_64 random_;
+    };
+}
+
+#endif //JDIFF_BENCH_CORPUS_HPP
@@ -0,0 +1,258 @@
+//
+// Microbenchmarks of hot kernels - rolling and strong hashing, signature map, (de)serialization and
+// file IO. Results are printed as table, JSON or CSV so runs of different releases can be compared.
+//
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include "bench_harness.hpp"
+#include "cxxopts.hpp"
+#include "diff.hpp"
+#include "file_reader.hpp"
+#include "file_writer.hpp"
+#include "rhash.hpp"
+#include "xxhash64.h"
+
+static constexpr uint32_t s_block_size = 4096;
+
+static std::vector<unsigned char> makeNoise(size_t size, uint32_t seed) {
+    std::vector<unsigned char> buffer(size);
+    for (auto &byte : buffer) {
+        seed = seed * 1664525 + 1013904223;
+        byte = static_cast<unsigned char>(seed >> 24);
+    }
+    return buffer;
+}
+
+static void benchHashes(bench::Harness &harness, const std::vector<unsigned char> &data) {
+    harness.run("rhash/roll", data.size(), [&] {
+        RHash rhash(s_block_size);
+        for (size_t i = 0; i < data.size(); i++) {
+            char oldest = i >= s_block_size ? static_cast<char>(data[i - s_block_size]) : 0;
+            rhash.roll(oldest, static_cast<char>(data[i]));
+        }
+        bench::doNotOptimize(rhash.hash());
+    });
+
+    std::vector<std::vector<unsigned char>> blocks;
+    for (size_t offset = 0; offset + s_block_size <= data.size(); offset += s_block_size) {
+        blocks.emplace_back(data.begin() + static_cast<long>(offset),
+                            data.begin() + static_cast<long>(offset + s_block_size));
+    }
+
+    harness.run("rhash/hashBuffer", blocks.size() * s_block_size, [&] {
+        for (const auto &block : blocks) {
+            bench::doNotOptimize(RHash::hashBuffer(block));
+        }
+    });
+
+    harness.run("xxhash64/4k", blocks.size() * s_block_size, [&] {
+        for (const auto &block : blocks) {
+            bench::doNotOptimize(XXHash64::hash(block.data(), block.size(), 0));
+        }
+    });
+
+    harness.run("xxhash64/whole", data.size(), [&] {
+        bench::doNotOptimize(XXHash64::hash(data.data(), data.size(), 0));
+    });
+}
+
+static void benchSignature(bench::Harness &harness, const std::vector<unsigned char> &data) {
+    uint64_t block_count = data.size() / s_block_size;
+    std::vector<uint32_t> weak(block_count);
+    std::vector<uint64_t> strong(block_count);
+    for (uint64_t i = 0; i < block_count; i++) {
+        const unsigned char *block = data.data() + i * s_block_size;
+        weak[i] = RHash::hashBuffer(std::vector<unsigned char>(block, block + s_block_size));
+        strong[i] = XXHash64::hash(block, s_block_size, 0);
+    }
+
+    diff::Signature inserted;
+    harness.run("signature/insert", block_count * s_block_size, [&] {
+        for (uint64_t i = 0; i < block_count; i++) {
+            inserted.addSignature(weak[i], strong[i], i);
+        }
+    }, [&] {
+        inserted.clear();
+        inserted.block_size = s_block_size;
+    });
+
+    // filled apart from signature/insert, so each benchmark also runs alone with --filter
+    diff::Signature signature;
+    signature.block_size = s_block_size;
+    for (uint64_t i = 0; i < block_count; i++) {
+        signature.addSignature(weak[i], strong[i], i);
+    }
+
+    harness.run("signature/lookup", block_count * s_block_size, [&] {
+        uint64_t found = 0;
+        for (uint64_t i = 0; i < block_count; i++) {
+            auto weak_hit = signature.signatures.find(weak[i]);
+            if (weak_hit != signature.signatures.end() && weak_hit->second.contains(strong[i])) {
+                found++;
+            }
+        }
+        bench::doNotOptimize(found);
+    });
+
+    std::vector<diff::ubyte_t> serialized = diff::Signature(signature).serialize();
+    harness.run("signature/serialize", serialized.size(), [&] {
+        diff::Signature copy = signature;
+        bench::doNotOptimize(copy.serialize().size());
+    });
+
+    harness.run("signature/deserialize", serialized.size(), [&] {
+        diff::Signature read;
+        read.deserialize(serialized);
+        bench::doNotOptimize(read.block_count);
+    });
+}
+
+static void benchDelta(bench::Harness &harness, const std::vector<unsigned char> &data) {
+    // every fourth block replaced by a literal, the next one deleted
+    diff::Delta delta;
+    delta.block_size = s_block_size;
+    uint64_t block_count = data.size() / s_block_size;
+    for (uint64_t i = 0; i + 1 < block_count; i += 4) {
+        const unsigned char *block = data.data() + i * s_block_size;
+        delta.inserts[i].assign(block, block + s_block_size);
+        delta.deletes[i + 1] = 1;
+    }
+
+    std::vector<diff::ubyte_t> serialized = diff::Delta(delta).serialize();
+    harness.run("delta/serialize", serialized.size(), [&] {
+        bench::doNotOptimize(delta.serialize().size());
+    });
+
+    harness.run("delta/deserialize", serialized.size(), [&] {
+        diff::Delta read;
+        read.deserialize(serialized);
+        bench::doNotOptimize(read.inserts.size());
+    });
+}
+
+static void benchFiles(bench::Harness &harness, const std::vector<unsigned char> &data) {
+    std::string input_path = (std::filesystem::temp_directory_path() / "jdiff_bench_input.bin").string();
+    std::string output_path = (std::filesystem::temp_directory_path() / "jdiff_bench_output.bin").string();
+    {
+        io::FileWriter writer(input_path);
+        writer.append(data);
+    }
+
+    std::unique_ptr<io::FileReader> reader;
+    auto open_reader = [&] { reader = std::make_unique<io::FileReader>(input_path, s_block_size); };
+
+    harness.run("file_reader/rollByte", data.size(), [&] {
+        uint64_t rolled = 0;
+        while (reader->rollByte()) {
+            rolled++;
+        }
+        bench::doNotOptimize(rolled);
+    }, open_reader);
+
+    harness.run("file_reader/getNextChunk", data.size(), [&] {
+        uint64_t read = 0;
+        for (auto chunk = reader->getNextChunk(); !chunk.empty(); chunk = reader->getNextChunk()) {
+            read += chunk.size();
+        }
+        bench::doNotOptimize(read);
+    }, open_reader);
+
+    std::vector<std::vector<unsigned char>> blocks;
+    for (size_t offset = 0; offset + s_block_size <= data.size(); offset += s_block_size) {
+        blocks.emplace_back(data.begin() + static_cast<long>(offset),
+                            data.begin() + static_cast<long>(offset + s_block_size));
+    }
+    harness.run("file_writer/append", blocks.size() * s_block_size, [&] {
+        io::FileWriter writer(output_path);
+        for (const auto &block : blocks) {
+            writer.append(block);
+        }
+    });
+
+    std::unique_ptr<io::MmapReader> mapped;
+    auto map_reader = [&] { mapped = std::make_unique<io::MmapReader>(input_path, s_block_size); };
+    harness.run("mmap_reader/rollByte", data.size(), [&] {
+        uint64_t rolled = 0;
+        while (mapped->rollByte()) {
+            rolled++;
+        }
+        bench::doNotOptimize(rolled);
+    }, map_reader);
+
+    // no block of the input is in the signature, every position is rolled; same engine through virtual
+    // io::FileReader calls and through the final mmap reader
+    std::vector<unsigned char> base = data;
+    for (auto &byte : base) {
+        byte ^= 0x5A;
+    }
+    io::MemoryReader base_reader(base, s_block_size);
+    diff::Diff d;
+    d.prepareSignatures(base_reader);
+    harness.run("delta/roll_file_reader", data.size(), [&] {
+        d.prepareDelta(d.signature(), *reader);
+    }, open_reader);
+    harness.run("delta/roll_mmap_reader", data.size(), [&] {
+        d.prepareDelta(d.signature(), *mapped);
+    }, map_reader);
+    reader.reset();
+    mapped.reset();
+
+    std::filesystem::remove(input_path);
+    std::filesystem::remove(output_path);
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options(argv[0], "jdiff kernels microbenchmark:");
+    options.add_options()
+            ("s,size", "Data size per repetition in MiB", cxxopts::value<uint32_t>()->default_value("16"), "<decimal>")
+            ("w,warmup", "Warm-up iterations", cxxopts::value<uint32_t>()->default_value("1"), "<decimal>")
+            ("r,repetitions", "Timed repetitions", cxxopts::value<uint32_t>()->default_value("10"), "<decimal>")
+            ("filter", "Run only benchmarks containing this text", cxxopts::value<std::string>()->default_value(""),
+                    "<text>")
+            ("format", "Output format", cxxopts::value<std::string>()->default_value("table"), "<table | json | csv>")
+            ("o,output", "Write results to file instead of stdout", cxxopts::value<std::string>(), "<file_path>")
+            ("h,help", "Print help");
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help")) {
+        std::cerr << options.help() << std::endl;
+        return 0;
+    }
+
+    try {
+        auto format = result["format"].as<std::string>();
+        if (format != "table" && format != "json" && format != "csv") {
+            throw std::invalid_argument(std::string("Unknown format " + format + "!"));
+        }
+
+        bench::Harness harness(result["warmup"].as<uint32_t>(), result["repetitions"].as<uint32_t>(),
+                               result["filter"].as<std::string>());
+        std::vector<unsigned char> data = makeNoise(static_cast<size_t>(result["size"].as<uint32_t>()) << 20, 1);
+
+        benchHashes(harness, data);
+        benchSignature(harness, data);
+        benchDelta(harness, data);
+        benchFiles(harness, data);
+
+        std::ofstream file;
+        if (result.count("output")) {
+            file.open(result["output"].as<std::string>());
+        }
+        std::ostream &os = result.count("output") ? file : std::cout;
+        if (format == "json") {
+            harness.printJson(os);
+        } else if (format == "csv") {
+            harness.printCsv(os);
+        } else {
+            harness.printTable(os);
+        }
+    } catch (std::invalid_argument &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,355 @@
+//
+// End-to-end benchmark on synthetic corpus: for every base kind and mutation it times signature, delta
+// and patch through the filemanager library, checks the patched file and reports throughput, delta size
+// ratio and peak RSS. Each scenario runs in forked process, so peak RSS is its own and not the max so far.
+//
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include "corpus.hpp"
+#include "cxxopts.hpp"
+#include "diff.hpp"
+#include "file_reader.hpp"
+#include "file_writer.hpp"
+
+struct ScenarioConfig {
+    std::string directory;
+    uint32_t block_size = 4096;
+    uint32_t repetitions = 1;
+    bool extend = false;
+    bool direct = false;
+    diff::Compression compression = diff::Compression::None;
+};
+
+// Sent from scenario process to the driver through pipe, so it's kept trivially copyable
+struct Measurement {
+    uint64_t base_size = 0;
+    uint64_t new_size = 0;
+    uint64_t signature_size = 0;
+    uint64_t delta_size = 0;
+    double signature_s = 0;
+    double delta_s = 0;
+    double patch_s = 0;
+    bool verified = false;
+    char error[256] = {};
+};
+
+struct ScenarioResult {
+    std::string base_kind;
+    std::string mutation;
+    Measurement measurement;
+    long peak_rss_kib = 0;
+};
+
+static void writeFile(const std::string &file_path, const std::vector<unsigned char> &data) {
+    io::FileWriter writer(file_path);
+    writer.append(data);
+}
+
+static bool equalFiles(const std::string &file_path1, const std::string &file_path2) {
+    std::ifstream is1(file_path1, std::ios_base::binary);
+    std::ifstream is2(file_path2, std::ios_base::binary);
+    return std::equal(std::istreambuf_iterator<char>(is1), std::istreambuf_iterator<char>(),
+                      std::istreambuf_iterator<char>(is2), std::istreambuf_iterator<char>());
+}
+
+template<typename F>
+static double timed(F &&body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs in the scenario process, best time of all repetitions is kept for every phase
+static Measurement measure(const ScenarioConfig &config, const std::string &base_path, const std::string &new_path) {
+    std::string signature_path = base_path + ".sig";
+    std::string delta_path = base_path + ".delta";
+    std::string patched_path = base_path + ".patched";
+
+    Measurement m;
+    m.base_size = std::filesystem::file_size(base_path);
+    m.new_size = std::filesystem::file_size(new_path);
+    for (uint32_t i = 0; i < config.repetitions; i++) {
+        double signature_s = 0;
+        double delta_s;
+        if (config.direct) {
+            delta_s = timed([&] {
+                diff::Diff d;
+                io::FileReader base_reader(base_path);
+                io::FileReader reader(new_path);
+                d.prepareDirectDelta(base_reader, reader);
+                d.generateDeltaFile(delta_path, config.compression);
+            });
+        } else {
+            signature_s = timed([&] {
+                diff::Diff d;
+                io::FileReader reader(base_path, config.block_size);
+                d.prepareSignatures(reader);
+                d.generateSignatureFile(signature_path);
+            });
+            delta_s = timed([&] {
+                diff::Diff d;
+                d.getSignatureFromFile(signature_path);
+                io::FileReader reader(new_path, d.signature().block_size, d.signature().chunking);
+                d.prepareDelta(d.signature(), reader);
+                if (config.extend) {
+                    io::FileReader base_reader(base_path, d.delta().block_size);
+                    d.extendMatches(base_reader);
+                }
+                d.generateDeltaFile(delta_path, config.compression);
+            });
+        }
+        double patch_s = timed([&] {
+            diff::Diff d;
+            io::FileReader dictionary_reader(base_path);
+            d.getDeltaFromFile(delta_path, &dictionary_reader);
+            io::FileReader reader(base_path, d.delta().block_size, d.delta().chunking);
+            io::FileWriter writer(patched_path);
+            diff::Diff::patchFile(d.delta(), reader, writer);
+        });
+
+        m.signature_s = i ? std::min(m.signature_s, signature_s) : signature_s;
+        m.delta_s = i ? std::min(m.delta_s, delta_s) : delta_s;
+        m.patch_s = i ? std::min(m.patch_s, patch_s) : patch_s;
+    }
+
+    m.signature_size = config.direct ? 0 : std::filesystem::file_size(signature_path);
+    m.delta_size = std::filesystem::file_size(delta_path);
+    m.verified = equalFiles(patched_path, new_path);
+    for (const auto &file_path : {signature_path, delta_path, patched_path}) {
+        std::filesystem::remove(file_path);
+    }
+    return m;
+}
+
+// Runs body in child process, so neither its memory nor the driver's counts to other scenarios
+template<typename F>
+static int runForked(F &&body, rusage &usage) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::invalid_argument("Can't fork scenario process!");
+    }
+    if (pid == 0) {
+        _exit(body());
+    }
+    int status = 0;
+    wait4(pid, &status, 0, &usage);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static ScenarioResult runScenario(const ScenarioConfig &config, uint64_t seed, bench::BaseKind kind,
+                                  bench::Mutation mutation, size_t size, uint32_t count) {
+    ScenarioResult result;
+    result.base_kind = bench::baseKindName(kind);
+    result.mutation = bench::mutationName(mutation);
+
+    std::string name = result.base_kind + "_" + result.mutation;
+    std::string base_path = (std::filesystem::path(config.directory) / (name + ".base")).string();
+    std::string new_path = (std::filesystem::path(config.directory) / (name + ".new")).string();
+
+    // corpus is generated in its own process too, freed buffers would stay in driver's heap and peak RSS
+    rusage usage{};
+    int generated = runForked([&] {
+        try {
+            bench::Corpus corpus(seed);
+            std::vector<unsigned char> data = corpus.generate(kind, size);
+            writeFile(base_path, data);
+            corpus.mutate(data, mutation, count);
+            writeFile(new_path, data);
+        } catch (std::exception &) {
+            return 1;
+        }
+        return 0;
+    }, usage);
+    if (generated != 0) {
+        throw std::invalid_argument(std::string("Can't write corpus files to " + config.directory + "!"));
+    }
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::invalid_argument("Can't create pipe for scenario process!");
+    }
+    runForked([&] {
+        close(fds[0]);
+        Measurement m;
+        try {
+            m = measure(config, base_path, new_path);
+        } catch (std::exception &e) {
+            std::strncpy(m.error, e.what(), sizeof(m.error) - 1);
+        }
+        ssize_t written = write(fds[1], &m, sizeof(m));
+        close(fds[1]);
+        return written == static_cast<ssize_t>(sizeof(m)) ? 0 : 1;
+    }, usage);
+    close(fds[1]);
+    ssize_t read_size = read(fds[0], &result.measurement, sizeof(result.measurement));
+    close(fds[0]);
+    if (read_size != static_cast<ssize_t>(sizeof(result.measurement))) {
+        std::strncpy(result.measurement.error, "scenario process died", sizeof(result.measurement.error) - 1);
+    }
+    // kilobytes on Linux
+    result.peak_rss_kib = usage.ru_maxrss;
+
+    std::filesystem::remove(base_path);
+    std::filesystem::remove(new_path);
+    return result;
+}
+
+static double throughput(uint64_t bytes, double seconds) {
+    return seconds > 0 ? static_cast<double>(bytes) / seconds / 1e6 : 0;
+}
+
+static double deltaRatio(const Measurement &m) {
+    return m.new_size ? static_cast<double>(m.delta_size) / static_cast<double>(m.new_size) : 0;
+}
+
+static std::string status(const Measurement &m) {
+    if (m.error[0]) return std::string("error: ") + m.error;
+    return m.verified ? "ok" : "mismatch";
+}
+
+static void printTable(std::ostream &os, const std::vector<ScenarioResult> &results) {
+    os << std::left << std::setw(18) << "scenario" << std::right << std::setw(12) << "new_bytes"
+       << std::setw(12) << "delta_bytes" << std::setw(9) << "ratio" << std::setw(11) << "sig_MB/s"
+       << std::setw(11) << "delta_MB/s" << std::setw(11) << "patch_MB/s" << std::setw(12) << "peak_KiB"
+       << "  status" << std::endl;
+    for (const auto &result : results) {
+        const auto &m = result.measurement;
+        os << std::left << std::setw(18) << result.base_kind + "/" + result.mutation << std::right
+           << std::setw(12) << m.new_size << std::setw(12) << m.delta_size << std::fixed << std::setprecision(4)
+           << std::setw(9) << deltaRatio(m) << std::setprecision(1)
+           << std::setw(11) << throughput(m.base_size, m.signature_s)
+           << std::setw(11) << throughput(m.new_size, m.delta_s)
+           << std::setw(11) << throughput(m.new_size, m.patch_s) << std::setw(12) << result.peak_rss_kib
+           << "  " << status(m) << std::endl;
+    }
+}
+
+static void printJson(std::ostream &os, const std::vector<ScenarioResult> &results) {
+    os << "{\"scenarios\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &result = results[i];
+        const auto &m = result.measurement;
+        os << (i ? ",\n  " : "\n  ") << std::fixed << std::setprecision(6)
+           << "{\"base\": \"" << result.base_kind << "\", \"mutation\": \"" << result.mutation
+           << "\", \"base_bytes\": " << m.base_size << ", \"new_bytes\": " << m.new_size
+           << ", \"signature_bytes\": " << m.signature_size << ", \"delta_bytes\": " << m.delta_size
+           << ", \"delta_ratio\": " << deltaRatio(m) << ", \"signature_s\": " << m.signature_s
+           << ", \"delta_s\": " << m.delta_s << ", \"patch_s\": " << m.patch_s
+           << ", \"peak_rss_kib\": " << result.peak_rss_kib << ", \"verified\": " << (m.verified ? "true" : "false")
+           << ", \"status\": \"" << status(m) << "\"}";
+    }
+    os << "\n]}" << std::endl;
+}
+
+static void printCsv(std::ostream &os, const std::vector<ScenarioResult> &results) {
+    os << "base,mutation,base_bytes,new_bytes,signature_bytes,delta_bytes,delta_ratio,signature_s,delta_s,patch_s,"
+          "peak_rss_kib,verified" << std::endl;
+    for (const auto &result : results) {
+        const auto &m = result.measurement;
+        os << std::fixed << std::setprecision(6) << result.base_kind << "," << result.mutation << ","
+           << m.base_size << "," << m.new_size << "," << m.signature_size << "," << m.delta_size << ","
+           << deltaRatio(m) << "," << m.signature_s << "," << m.delta_s << "," << m.patch_s << ","
+           << result.peak_rss_kib << "," << (m.verified ? 1 : 0) << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options(argv[0], "jdiff end-to-end benchmark on synthetic corpus:");
+    options.add_options()
+            ("s,size", "Base file size in MiB", cxxopts::value<uint32_t>()->default_value("64"), "<decimal>")
+            ("k,kinds", "Base file kinds", cxxopts::value<std::vector<std::string>>()->default_value(
+                    "random,text,zero,vm"), "<random,text,zero,vm>")
+            ("m,mutations", "Mutations applied to the base", cxxopts::value<std::vector<std::string>>()->default_value(
+                    "edit,insert,delete,move,append,truncate"), "<edit,insert,delete,move,append,truncate>")
+            ("n,count", "Mutations per scenario", cxxopts::value<uint32_t>()->default_value("16"), "<decimal>")
+            ("b,block-size", "Signature block size", cxxopts::value<uint32_t>()->default_value("4096"), "<decimal>")
+            ("r,repetitions", "Repetitions per scenario, best time is reported",
+                    cxxopts::value<uint32_t>()->default_value("1"), "<decimal>")
+            ("seed", "Corpus seed", cxxopts::value<uint64_t>()->default_value("1"), "<decimal>")
+            ("e,extend", "Extend matches with local base (delta -e)")
+            ("direct", "Direct two-file delta instead of signature round trip")
+            ("z,compress", "Compress delta literals", cxxopts::value<std::string>()->implicit_value("auto"),
+                    "<auto | zlib | zstd | none>")
+            ("d,dir", "Directory of corpus files", cxxopts::value<std::string>(), "<dir_path>")
+            ("format", "Output format", cxxopts::value<std::string>()->default_value("table"), "<table | json | csv>")
+            ("o,output", "Write results to file instead of stdout", cxxopts::value<std::string>(), "<file_path>")
+            ("h,help", "Print help");
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help")) {
+        std::cerr << options.help() << std::endl;
+        return 0;
+    }
+
+    try {
+        auto format = result["format"].as<std::string>();
+        if (format != "table" && format != "json" && format != "csv") {
+            throw std::invalid_argument(std::string("Unknown format " + format + "!"));
+        }
+
+        ScenarioConfig config;
+        config.directory = result.count("dir") ? result["dir"].as<std::string>()
+                                               : std::filesystem::temp_directory_path().string();
+        config.block_size = result["block-size"].as<uint32_t>();
+        config.repetitions = std::max<uint32_t>(1, result["repetitions"].as<uint32_t>());
+        config.extend = result.count("extend");
+        config.direct = result.count("direct");
+        if (result.count("compress")) {
+            config.compression = diff::compressionFromString(result["compress"].as<std::string>());
+        }
+
+        std::vector<bench::BaseKind> kinds;
+        for (const auto &name : result["kinds"].as<std::vector<std::string>>()) {
+            kinds.push_back(bench::baseKindFromString(name));
+        }
+        std::vector<bench::Mutation> mutations;
+        for (const auto &name : result["mutations"].as<std::vector<std::string>>()) {
+            mutations.push_back(bench::mutationFromString(name));
+        }
+
+        size_t size = static_cast<size_t>(result["size"].as<uint32_t>()) << 20;
+        // every scenario has its own seed, so it is reproducible regardless of the selected subset
+        uint64_t seed = result["seed"].as<uint64_t>();
+        std::vector<ScenarioResult> results;
+        for (auto kind : kinds) {
+            for (auto mutation : mutations) {
+                uint64_t scenario_seed = seed * 1000 + static_cast<uint64_t>(kind) * 10 + static_cast<uint64_t>(mutation);
+                results.push_back(runScenario(config, scenario_seed, kind, mutation, size,
+                                              result["count"].as<uint32_t>()));
+            }
+        }
+
+        std::ofstream file;
+        if (result.count("output")) {
+            file.open(result["output"].as<std::string>());
+        }
+        std::ostream &os = result.count("output") ? file : std::cout;
+        if (format == "json") {
+            printJson(os, results);
+        } else if (format == "csv") {
+            printCsv(os, results);
+        } else {
+            printTable(os, results);
+        }
+
+        for (const auto &scenario : results) {
+            if (status(scenario.measurement) != "ok") {
+                return 1;
+            }
+        }
+    } catch (std::invalid_argument &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+//
+// Compares rolling hash families on real data: for every base block signature it rolls
+// over the new file and reports how many weak hits were confirmed by the strong hash
+// (false-positive rate) and how many nanoseconds the rolling itself costs per byte.
+//
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "cxxopts.hpp"
+#include "rolling_hash.hpp"
+#include "xxhash64.h"
+
+struct HashReport {
+    uint64_t positions = 0;
+    uint64_t weak_hits = 0;
+    uint64_t strong_hits = 0;
+    double roll_ns_per_byte = 0;
+};
+
+static std::vector<unsigned char> readFile(const std::string &file_path) {
+    std::ifstream is(file_path, std::ios_base::binary);
+    if (!is) {
+        throw std::invalid_argument(std::string("File " + file_path + " doesn't exist or broken!"));
+    }
+    return std::vector<unsigned char>{(std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>()};
+}
+
+static volatile uint32_t s_sink;
+
+template<RollingHash H>
+static HashReport measure(const std::vector<unsigned char> &base, const std::vector<unsigned char> &data,
+                          uint16_t block_size) {
+    HashReport report;
+    std::unordered_map<uint32_t, std::unordered_set<uint64_t>> signatures;
+
+    for (size_t offset = 0; offset < base.size(); offset += block_size) {
+        auto end = std::min(base.size(), offset + block_size);
+        std::vector<unsigned char> block(base.begin() + static_cast<long>(offset), base.begin() + static_cast<long>(end));
+        signatures[H::hashBuffer(block)].insert(XXHash64::hash(block.data(), block.size(), 0));
+    }
+
+    // Pure rolling cost, kept apart from lookups so the numbers compare hash families only
+    uint32_t sink = 0;
+    H timed(block_size);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < data.size(); i++) {
+        char oldest = i >= block_size ? static_cast<char>(data[i - block_size]) : 0;
+        timed.roll(oldest, static_cast<char>(data[i]));
+        sink ^= timed.hash();
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    report.roll_ns_per_byte = data.empty() ? 0 : elapsed / static_cast<double>(data.size());
+    s_sink = sink;
+
+    H rhash(block_size);
+    for (size_t i = 0; i < data.size(); i++) {
+        char oldest = i >= block_size ? static_cast<char>(data[i - block_size]) : 0;
+        rhash.roll(oldest, static_cast<char>(data[i]));
+        if (i + 1 < block_size) continue;
+
+        report.positions++;
+        auto found = signatures.find(rhash.hash());
+        if (found == signatures.end()) continue;
+
+        report.weak_hits++;
+        if (found->second.contains(XXHash64::hash(&data[i + 1 - block_size], block_size, 0))) {
+            report.strong_hits++;
+        }
+    }
+
+    return report;
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options(argv[0], "Rolling hash families benchmark:");
+    options.add_options()
+            ("b,block-size", "Block size to hash", cxxopts::value<uint16_t>()->default_value("4096"), "<decimal>")
+            ("base", "Base file", cxxopts::value<std::string>(), "<file_path>")
+            ("new", "New file, base is rolled over itself if omitted", cxxopts::value<std::string>(), "<file_path>")
+            ("h,help", "Print help");
+    options.parse_positional({"base", "new"});
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("base")) {
+        std::cerr << options.help() << std::endl;
+        return 0;
+    }
+
+    try {
+        auto block_size = result["block-size"].as<uint16_t>();
+        auto base = readFile(result["base"].as<std::string>());
+        auto data = result.count("new") ? readFile(result["new"].as<std::string>()) : base;
+
+        std::cout << std::left << std::setw(12) << "hash" << std::setw(14) << "positions" << std::setw(12)
+                  << "weak_hits" << std::setw(14) << "strong_hits" << std::setw(14) << "false_pos_%"
+                  << "ns/byte" << std::endl;
+
+        for (auto type : {RollingHashType::Adler, RollingHashType::RabinKarp, RollingHashType::BuzHash}) {
+            HashReport report = visitRollingHash(type, [&]<typename H>(std::type_identity<H>) {
+                return measure<H>(base, data, block_size);
+            });
+            double false_positive = report.positions == 0 ? 0 :
+                    100.0 * static_cast<double>(report.weak_hits - report.strong_hits) /
+                    static_cast<double>(report.positions);
+
+            std::cout << std::left << std::setw(12) << rollingHashName(type) << std::setw(14) << report.positions
+                      << std::setw(12) << report.weak_hits << std::setw(14) << report.strong_hits
+                      << std::setw(14) << std::setprecision(6) << false_positive
+                      << std::setprecision(3) << report.roll_ns_per_byte << std::endl;
+        }
+    } catch (std::invalid_argument &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
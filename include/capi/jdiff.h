@@ -0,0 +1,81 @@
+/*
+ * C ABI of the jdiff engine (libjdiff.so), for use from runtimes that can't link C++. Signature and delta
+ * contexts are opaque handles. Input is fed in pieces and processed by finish, results are copied into caller
+ * buffers. Feed isn't streaming: fed pieces are copied into the handle and the whole input is kept until finish,
+ * so memory grows with the full base or new file, not with the piece size. Functions return JDIFF_OK or a negative status, jdiff_last_error() describes the last failure of
+ * the calling thread. Handles may be used from any thread, but not from two threads at once.
+ */
+
+#ifndef JDIFF_C_API_H
+#define JDIFF_C_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(JDIFF_C_BUILD)
+#define JDIFF_API __attribute__((visibility("default")))
+#else
+#define JDIFF_API
+#endif
+
+/* bumped on incompatible change of the functions below */
+#define JDIFF_ABI_VERSION 1
+
+enum jdiff_status {
+    JDIFF_OK = 0,
+    JDIFF_ERROR = -1,
+    /* null handle or pointer, malformed or truncated signature or delta bytes, base not matching delta sha */
+    JDIFF_INVALID_ARGUMENT = -2,
+    /* result didn't fit, required size is stored to *written */
+    JDIFF_BUFFER_TOO_SMALL = -3,
+    /* call isn't allowed in current state, e.g. feed after finish */
+    JDIFF_INVALID_STATE = -4
+};
+
+enum jdiff_flags {
+    /* signature stores sha256 of base, delta copies it and patch can check the base */
+    JDIFF_FLAG_SHA = 1,
+    /* content defined chunks instead of fixed blocks */
+    JDIFF_FLAG_CDC = 2
+};
+
+typedef struct jdiff_signature jdiff_signature;
+typedef struct jdiff_delta jdiff_delta;
+
+JDIFF_API uint32_t jdiff_abi_version(void);
+/* message of the last failed call on this thread, empty string when there was none */
+JDIFF_API const char *jdiff_last_error(void);
+
+/* block_size 0 derives it from the size of fed base */
+JDIFF_API jdiff_signature *jdiff_signature_create(uint32_t block_size, uint32_t flags);
+/* copies data into the handle, whole base is held until finish */
+JDIFF_API int jdiff_signature_feed(jdiff_signature *signature, const void *data, size_t size);
+JDIFF_API int jdiff_signature_finish(jdiff_signature *signature);
+/* serialized signature (signature file bytes) of finished or loaded signature */
+JDIFF_API int jdiff_signature_serialize(const jdiff_signature *signature, void *buffer, size_t capacity,
+                                        size_t *written);
+JDIFF_API jdiff_signature *jdiff_signature_load(const void *data, size_t size);
+JDIFF_API void jdiff_signature_free(jdiff_signature *signature);
+
+/* signature has to be finished or loaded, it's copied so it may be freed right after */
+JDIFF_API jdiff_delta *jdiff_delta_create(const jdiff_signature *signature);
+/* copies data into the handle, whole new file is held until finish */
+JDIFF_API int jdiff_delta_feed(jdiff_delta *delta, const void *data, size_t size);
+JDIFF_API int jdiff_delta_finish(jdiff_delta *delta);
+JDIFF_API int jdiff_delta_serialize(const jdiff_delta *delta, void *buffer, size_t capacity, size_t *written);
+JDIFF_API jdiff_delta *jdiff_delta_load(const void *data, size_t size);
+JDIFF_API void jdiff_delta_free(jdiff_delta *delta);
+
+/* Writes file patched by finished or loaded delta. flags JDIFF_FLAG_SHA checks base against delta sha. */
+JDIFF_API int jdiff_patch(const jdiff_delta *delta, const void *base, size_t base_size, uint32_t flags,
+                          void *output, size_t capacity, size_t *written);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JDIFF_C_API_H */
@@ -0,0 +1,111 @@
+//
+// Many signature, delta, patch and diff jobs in one process. Items of a manifest run on a work stealing pool,
+// an I/O budget caps the input bytes all workers have in flight, so many small files keep every core busy and
+// a few large ones don't exhaust memory.
+
+#ifndef JDIFF_BATCH_HPP
+#define JDIFF_BATCH_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "diff.hpp"
+
+namespace diff {
+
+    enum class BatchOp : uint8_t {
+        Signature = 0,
+        Delta,
+        Patch,
+        Diff
+    };
+
+    BatchOp batchOpFromString(const std::string &name);
+    const char * batchOpName(BatchOp op);
+
+    // Manifest line "<op> <input>... <output>", inputs as the command line takes them:
+    //   signature <base> <out>, delta <signature> <new> <out>, patch <base> <delta> <out>, diff <base> <new> <out>
+    struct BatchItem {
+        BatchOp op;
+        std::vector<std::string> inputs;
+        std::string output;
+        // manifest line, for reports
+        size_t line = 0;
+    };
+
+    struct BatchResult {
+        bool ok = false;
+        std::string error;
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+        uint64_t wall_ns = 0;
+    };
+
+    struct BatchOptions {
+        // 0 means hardware concurrency
+        unsigned threads = 0;
+        uint64_t io_budget = (256 << 20);
+        bool sha = false;
+        bool force = false;
+        uint32_t block_size = 0;
+        io::Chunking chunking = io::Chunking::Fixed;
+        RollingHashType rolling_hash = RollingHashType::Adler;
+        Compression compression = Compression::None;
+    };
+
+    // Paths with spaces are double quoted, empty lines and lines starting with # are skipped. Output written by
+    // two lines throws, and so does input that is output of the same or a later line.
+    std::vector<BatchItem> parseManifest(std::istream &manifest);
+
+    // Input bytes in flight, acquire blocks until they fit. Item larger than the whole budget runs alone.
+    class IoBudget {
+    public:
+        explicit IoBudget(uint64_t limit) : limit_(limit) {}
+
+        void acquire(uint64_t bytes);
+        void release(uint64_t bytes);
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable released_;
+        uint64_t limit_;
+        uint64_t in_flight_ = 0;
+    };
+
+    // Workers take tasks from the front of their own queue and steal from the back of others when it is empty
+    class WorkStealingPool {
+    public:
+        explicit WorkStealingPool(unsigned threads = 0);
+
+        // Runs task(i) for every i of order, queued to workers round robin. Returns when all are done.
+        void run(const std::vector<size_t> &order, const std::function<void(size_t)> &task);
+
+        unsigned threads() const { return static_cast<unsigned>(queues_.size()); }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        bool take(unsigned worker, size_t &task);
+
+        std::deque<Queue> queues_;
+    };
+
+    // Called once per finished item, calls are serialized
+    typedef std::function<void(const BatchItem &, const BatchResult &)> BatchCallback;
+
+    // Failure of an item is reported in its result, the rest keep running. Item reading output of an earlier item
+    // runs in a later stage, after it's written, and fails when that item failed. Items of a stage run in
+    // parallel, larger inputs first.
+    std::vector<BatchResult> runBatch(const std::vector<BatchItem> &items, const BatchOptions &options,
+                                      const BatchCallback &on_done = {});
+}
+
+#endif //JDIFF_BATCH_HPP
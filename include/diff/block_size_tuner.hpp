@@ -0,0 +1,57 @@
+//
+// Block size auto-tuning. Block size trades signature size (one entry per block) against delta size
+// (every changed region costs about one block of literals), so the cost minimum lies at
+// sqrt(file_size * entry_cost / changed_regions).
+
+#ifndef JDIFF_BLOCK_SIZE_TUNER_HPP
+#define JDIFF_BLOCK_SIZE_TUNER_HPP
+
+#include <cstdint>
+#include "diff.hpp"
+
+namespace diff {
+
+    struct BlockSizeEstimate {
+        uint32_t block_size = 0;
+        uint64_t signature_bytes = 0;
+        uint64_t delta_bytes = 0;
+        uint64_t cpu_cost = 0;
+
+        uint64_t total() const { return signature_bytes + delta_bytes + cpu_cost; }
+    };
+
+    class BlockSizeTuner {
+    public:
+        explicit BlockSizeTuner(uintmax_t file_size);
+
+        // Learns change rate from previous signature and delta of the same data
+        void sampleChanges(const Signature &signature, const Delta &delta);
+
+        BlockSizeEstimate estimate(uint32_t block_size) const;
+        // sqrt(file_size) heuristic without sample, cheapest power of two block size with one
+        BlockSizeEstimate tune() const;
+
+        static uint32_t sqrtBlockSize(uintmax_t file_size);
+
+    private:
+        // serialized bytes of one signature block - weak hash, strong hash, index and in-order strong hash
+        static constexpr inline uint64_t s_signature_entry_bytes = 36;
+        // serialized bytes of one insert or delete record
+        static constexpr inline uint64_t s_delta_entry_bytes = 24;
+        // per block work (strong hash, lookup) expressed in transferred byte equivalents
+        static constexpr inline uint64_t s_cpu_block_cost = 16;
+        // changed regions assumed without sample, makes sqrt(file_size) the cost optimal block size
+        static constexpr inline double s_default_changed_regions = 32.0;
+
+        static constexpr inline uint32_t s_min_block_size = 512;
+        static constexpr inline uint32_t s_max_block_size = 1024*1024*64;
+
+        uintmax_t file_size_;
+        // changed regions and bytes edited per region, per byte of file
+        double changed_regions_rate_;
+        double edit_bytes_per_region_;
+        bool sampled_;
+    };
+}
+
+#endif //JDIFF_BLOCK_SIZE_TUNER_HPP
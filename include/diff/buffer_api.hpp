@@ -0,0 +1,56 @@
+//
+// Library API over bytes in memory, for embedding jdiff without temp files. Inputs are spans the caller keeps
+// alive for the call, outputs are handed to a sink piece by piece as they are produced.
+
+#ifndef JDIFF_BUFFER_API_HPP
+#define JDIFF_BUFFER_API_HPP
+
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <vector>
+#include "diff.hpp"
+
+namespace diff {
+
+    typedef std::function<void(std::span<const std::byte>)> ByteCallback;
+
+    // Engine writer forwarding every append to the callback
+    class CallbackWriter {
+    public:
+        explicit CallbackWriter(const ByteCallback &callback) : callback_(callback) {}
+
+        void append(const unsigned char *data, size_t size) {
+            callback_(std::as_bytes(std::span<const unsigned char>(data, size)));
+        }
+
+    private:
+        const ByteCallback &callback_;
+    };
+
+    struct SignatureOptions {
+        // 0 derives block size from input size like the command line does
+        uint32_t block_size = 0;
+        io::Chunking chunking = io::Chunking::Fixed;
+        RollingHashType rolling_hash = RollingHashType::Adler;
+        bool sha = false;
+    };
+
+    Signature makeSignature(std::span<const std::byte> base, const SignatureOptions &options = {});
+    Delta makeDelta(const Signature &signature, std::span<const std::byte> target, bool sha = false);
+    Delta makeDirectDelta(std::span<const std::byte> base, std::span<const std::byte> target, bool sha = false,
+                          unsigned threads = 0);
+
+    // Patched data goes to sink in pieces, whole output is never held in memory
+    void applyDelta(const Delta &delta, std::span<const std::byte> base, const ByteCallback &sink,
+                    bool check_sha = false);
+    std::vector<std::byte> applyDelta(const Delta &delta, std::span<const std::byte> base, bool check_sha = false);
+
+    // Same bytes as signature and delta files. Base is read only by base dictionary compression of delta.
+    void serializeSignature(const Signature &signature, const ByteCallback &sink);
+    Signature deserializeSignature(std::span<const std::byte> data);
+    void serializeDelta(const Delta &delta, const ByteCallback &sink, std::span<const std::byte> base = {});
+    Delta deserializeDelta(std::span<const std::byte> data, std::span<const std::byte> base = {});
+}
+
+#endif //JDIFF_BUFFER_API_HPP
@@ -0,0 +1,68 @@
+//
+// Literal payload compression of deltas. Codecs are optional at build time (JDIFF_WITH_ZLIB,
+// JDIFF_WITH_ZSTD), the codec used is recorded in the delta, so a build without it rejects the file.
+
+#ifndef JDIFF_COMPRESSION_HPP
+#define JDIFF_COMPRESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace diff {
+
+    enum class Compression : uint8_t {
+        None = 0,
+        Zlib = 1,
+        Zstd = 2
+    };
+
+    bool isCompressionAvailable(Compression compression);
+    // Best codec of this build, None when built without any
+    Compression defaultCompression();
+    Compression compressionFromString(const std::string &name);
+    std::string compressionName(Compression compression);
+    // Most bytes compressed_size bytes of the codec can inflate to, bounds sizes declared next to the frame
+    uint64_t maxDecompressedSize(Compression compression, uint64_t compressed_size);
+
+    // Single literal run primed with dictionary (base data around the run). Frame checksum fails on different
+    // dictionary, sizes are stored by the caller. Returns empty vector when frame wouldn't be smaller than data.
+    std::vector<unsigned char> compressWithDictionary(Compression compression, const unsigned char *data, size_t size,
+                                                      const std::vector<unsigned char> &dictionary);
+    void decompressWithDictionary(Compression compression, const unsigned char *frame, size_t frame_size,
+                                  unsigned char *output, size_t size, const std::vector<unsigned char> &dictionary);
+
+    // Streams data into compressed frame appended to output
+    class Compressor {
+    public:
+        Compressor(Compression compression, std::vector<unsigned char> &output);
+        ~Compressor();
+
+        void write(const unsigned char *data, size_t size);
+        void finish();
+
+        struct Codec;
+    private:
+        std::unique_ptr<Codec> codec_;
+    };
+
+    // Reads compressed frame piece by piece, so literals are inflated straight to their destination
+    class Decompressor {
+    public:
+        Decompressor(Compression compression, const unsigned char *data, size_t size);
+        ~Decompressor();
+
+        // Fills exactly size bytes, throws when frame ends early or is corrupted
+        void read(unsigned char *output, size_t size);
+        // Throws unless the frame ends right after the bytes read
+        void finish();
+
+        struct Codec;
+    private:
+        std::unique_ptr<Codec> codec_;
+    };
+}
+
+#endif //JDIFF_COMPRESSION_HPP
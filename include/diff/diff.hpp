@@ -8,10 +8,19 @@
 #include <unordered_map>
 #include <vector>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <fstream>
-#include <openssl/sha.h>
+#include <optional>
+#include <stdexcept>
+#include "byte_stream.hpp"
+#include "compression.hpp"
 #include "file_reader.hpp"
 #include "file_writer.hpp"
+#include "memory_reader.hpp"
+#include "memory_writer.hpp"
+#include "rolling_hash.hpp"
+#include "stats.hpp"
 
 namespace diff{
 
@@ -33,69 +42,290 @@ namespace diff{
         }
     }
 
+    // Throws when the value doesn't fit in the remaining bytes, lengths of serialized files aren't trusted
     template<typename T>
     void generic_read_var_offset(std::vector<ubyte_t> &buff, size_t offset, T& t) {
+        if(offset > buff.size() || buff.size() - offset < sizeof(T)) {
+            throw std::invalid_argument("Buffer is truncated!");
+        }
         for(int i = 0; i < sizeof(T); i++) {
             t = t | (static_cast<T>(buff[offset+i]) << ((sizeof(T)-i-1)*8));
         }
     }
 
-    struct Delta {
+    // Owns memory of signature or delta containers. Their nodes come from few large pool chunks instead of one
+    // heap allocation each, and the chunks are released at once with the last owner. Base class, so the pool is
+    // created before the containers and destroyed after them. Copy gets own pool, move shares it with the
+    // moved-from structure, so stolen nodes stay valid. The pool isn't synchronized, moved-from structure has to
+    // stay on the thread of the moved-to one until it's destroyed (Diff::take* rebuild theirs on a fresh pool).
+    class ArenaOwner {
+    protected:
+        ArenaOwner() : arena_(std::make_shared<std::pmr::unsynchronized_pool_resource>()) {}
+        ArenaOwner(const ArenaOwner &) : ArenaOwner() {}
+        ArenaOwner(ArenaOwner &&other) noexcept : arena_(other.arena_) {}
+        // containers keep their pool and copy or move elements into it
+        ArenaOwner & operator=(const ArenaOwner &) { return *this; }
+        ArenaOwner & operator=(ArenaOwner &&) noexcept { return *this; }
+        ~ArenaOwner() = default;
+
+        std::pmr::memory_resource * arena() const { return arena_.get(); }
+
+    private:
+        std::shared_ptr<std::pmr::unsynchronized_pool_resource> arena_;
+    };
+
+    // Bytes of deleted block run still reused at byte granularity - head bytes of the first deleted block
+    // are written before the run's insert, tail bytes of the last deleted block after it
+    struct Extension {
+        uint64_t head = 0;
+        uint64_t tail = 0;
+    };
+
+    enum class DeltaFormat : uint8_t {
+        // inserts/deletes keyed by base block index, base is walked block by block in order
+        Blocks = 0,
+        // copy/literal instructions at arbitrary base offsets
+        Instructions = 1
+    };
+
+    struct Instruction {
+        enum class Type : uint8_t {
+            Copy = 0,
+            Literal = 1
+        };
+
+        Type type;
+        // base file offset for copy, offset to Delta::literals for literal
+        uint64_t offset;
+        uint64_t length;
+
+        // serialized type, offset and length
+        static constexpr size_t s_encoded_size = sizeof(uint8_t) + 2 * sizeof(uint64_t);
+    };
+
+    struct Delta : private ArenaOwner {
         sha256_t sha;
-        uint16_t block_size;
-        std::map<uint32_t, std::vector<ubyte_t>> inserts;
-        std::map<uint32_t, uint32_t> deletes;
+        uint32_t block_size;
+        io::Chunking chunking;
+        DeltaFormat format;
+        // codec of literal bytes in serialized delta, in memory literals are always plain
+        Compression compression;
+        // literal runs compressed one by one with base data around them as dictionary, base is needed to read
+        bool base_dictionary;
+        std::pmr::map<uint64_t, std::pmr::vector<ubyte_t>> inserts;
+        std::pmr::map<uint64_t, uint64_t> deletes;
+        std::pmr::map<uint64_t, Extension> extensions;
+        std::vector<Instruction> instructions;
+        std::vector<ubyte_t> literals;
+
+        Delta() : block_size(0), chunking(io::Chunking::Fixed), format(DeltaFormat::Blocks),
+                  compression(Compression::None), base_dictionary(false),
+                  inserts(arena()), deletes(arena()), extensions(arena()) {}
+        Delta(const Delta &other) : Delta() { *this = other; }
+        Delta(Delta &&other) = default;
+        Delta & operator=(const Delta &other) = default;
+        Delta & operator=(Delta &&other) = default;
 
-        Delta() : block_size(0) {}
+        static constexpr uint32_t s_magic = 0x4A444C54; // "JDLT"
+        static constexpr uint16_t s_version = 5;
+        static constexpr std::size_t s_dictionary_size = (1 << 15);
+        static constexpr std::size_t s_dictionary_min_run = 128;
+        static constexpr std::size_t s_dictionary_piece = (1 << 14);
+
+        // Appends instruction, merges it with previous one when they are contiguous
+        void addCopy(uint64_t base_offset, uint64_t length);
+        void addLiteral(const ubyte_t *data, uint64_t length);
 
         void clear();
-        std::vector<ubyte_t> serialize();
-        void deserialize(std::vector<ubyte_t> buff);
+        // Base file is read only by base dictionary compression
+        std::vector<ubyte_t> serialize(io::FileReader *r_base_file = nullptr) const;
+        void deserialize(std::vector<ubyte_t> buff, io::FileReader *r_base_file = nullptr);
     };
 
-    struct Signature {
+    struct Signature : private ArenaOwner {
         std::vector<ubyte_t> sha;
-        uint16_t block_size;
-        std::unordered_map<uint32_t, std::unordered_map<uint64_t, uint32_t>> signatures;
+        uint32_t block_size;
+        RollingHashType rolling_hash;
+        io::Chunking chunking;
+        uint64_t block_count;
+        uint64_t file_size;
+        // strong hashes of every full group of super_block_factor blocks, lets delta skip unchanged regions
+        uint32_t super_block_factor;
+        std::vector<uint64_t> super_hashes;
+        // strong hash of every block in base order, used to confirm the expected next block without lookup
+        std::vector<uint64_t> block_hashes;
+        std::pmr::unordered_map<uint32_t, std::pmr::unordered_map<uint64_t, uint64_t>> signatures;
 
-        Signature() : block_size(0){}
+        Signature() : block_size(0), rolling_hash(RollingHashType::Adler), chunking(io::Chunking::Fixed),
+                      block_count(0), file_size(0), super_block_factor(0), signatures(arena()) {}
+        Signature(const Signature &other) : Signature() { *this = other; }
+        Signature(Signature &&other) = default;
+        Signature & operator=(const Signature &other) = default;
+        Signature & operator=(Signature &&other) = default;
 
-        void addSignature(uint32_t rhash, uint64_t xxhash, uint32_t index);
+        static constexpr uint32_t s_magic = 0x4A534947; // "JSIG"
+        static constexpr uint16_t s_version = 2;
+
+        void addSignature(uint32_t rhash, uint64_t xxhash, uint64_t index);
         uint64_t countSignatures();
-        std::vector<ubyte_t> serialize();
+        // length of the last block when base isn't block aligned, 0 otherwise
+        uint64_t tailSize() const;
+        std::vector<ubyte_t> serialize() const;
         void deserialize(std::vector<ubyte_t> buff);
         void clear();
     };
 
+    // Incremental SHA-256 of streamed data, OpenSSL digest context stays in diff.cpp
+    class Sha256 {
+    public:
+        static constexpr size_t s_size = 32;
+
+        Sha256();
+        ~Sha256();
+        Sha256(const Sha256 &) = delete;
+        Sha256 & operator=(const Sha256 &) = delete;
+
+        void update(const ubyte_t *data, size_t size);
+        sha256_t finish();
+
+    private:
+        struct Context;
+        std::unique_ptr<Context> context_;
+    };
+
+    // Patched file sink, counts written bytes and hashes them when reverse delta is recorded
+    template<io::ByteSink Writer>
+    class PatchOutput {
+    public:
+        PatchOutput(Writer &writer, Delta *reverse, Stats *stats = nullptr);
+
+        // Returns output offset of appended data
+        uint64_t append(const ubyte_t *data, size_t size);
+        uint64_t append(const std::vector<ubyte_t> &data) { return append(data.data(), data.size()); }
+        // Sets sha of reverse delta, its base is the patched file
+        void finish();
+
+        Delta * reverse() const { return reverse_; }
+
+    private:
+        Writer &writer_;
+        Delta *reverse_;
+        Stats *stats_;
+        uint64_t written_;
+        std::optional<Sha256> sha_;
+    };
+
     class Diff {
     public:
         Diff() = default;
         Diff(const Diff &diff) = delete;
 
-        void prepareSignatures(io::FileReader &reader, bool sha=false);
-        void prepareDelta(const Signature &s, io::FileReader &reader, bool sha=false);
+        // Signature, delta and patch are compiled for the reader and writer they get: final ones (io::MemoryReader,
+        // io::MmapReader, io::MemoryWriter) are called directly in the byte loops, io::FileReader & and
+        // io::FileWriter & dispatch virtually to any derived class
+        template<io::ByteSource Reader>
+        void prepareSignatures(Reader &reader, bool sha=false,
+                               RollingHashType rolling_hash=RollingHashType::Adler, uint32_t super_block_factor=0);
+        template<io::ByteSource Reader>
+        void prepareDelta(const Signature &s, Reader &reader, bool sha=false);
+        // Shrinks literals of fixed block delta to the edited bytes, compares them with local base file
+        void extendMatches(io::FileReader &r_base_file);
+        // Delta of two local files, matches found at any offset and length (no signature round trip)
+        void prepareDirectDelta(io::FileReader &r_base_file, io::FileReader &reader, bool sha=false,
+                                unsigned threads=0);
+
+        // Merges chain of deltas (base -> v1 -> ... -> vN) to single instruction delta against the base. Block
+        // deltas are converted by block math, base size is needed only when the first one is block delta.
+        void composeDeltas(const std::vector<Delta> &deltas, uint64_t base_size=0);
 
         void generateSignatureFile(const std::string &file_path);
         void getSignatureFromFile(const std::string &file_path);
 
-        void generateDeltaFile(const std::string &file_path);
-        void getDeltaFromFile(const std::string &file_path);
+        // With base file literals are compressed using neighbouring base data as dictionary
+        void generateDeltaFile(const std::string &file_path, Compression compression=Compression::None,
+                               io::FileReader *r_base_file=nullptr);
+        void getDeltaFromFile(const std::string &file_path, io::FileReader *r_base_file=nullptr);
 
-        static void patchFile(const Delta &delta, io::FileReader &r_base_file,
-                              io::FileWriter &w_new_file, bool checkSha=false, const sha256_t& checksum={});
+        // Reverse delta (new -> old) is recorded on the way when requested, base is read no more than by patch
+        template<io::ByteSource Reader, io::ByteSink Writer>
+        static void patchFile(const Delta &delta, Reader &r_base_file, Writer &w_new_file, bool checkSha=false,
+                              const sha256_t& checksum={}, Delta *reverse=nullptr);
+        static Delta toInstructions(const Delta &delta, uint64_t base_size);
+        // Delta from older's base to newer's result, newer must be instruction delta against older's result
+        static Delta composePair(const Delta &older, const Delta &newer);
+        static uint64_t outputSize(const Delta &delta);
         static sha256_t calculateFileSha256(const std::string &file_path);
+        static sha256_t calculateSha256(const ubyte_t *data, size_t size);
         static bool compareSha(const sha256_t &hash1, const sha256_t &hash2);
 
         const Signature & signature() const { return signature_; }
         const Delta & delta() const { return delta_; }
+        // Move prepared result out, following calls start from empty one on its own pool, so taken result and
+        // this Diff may be used on different threads
+        Signature takeSignature() { return takeFresh(signature_); }
+        Delta takeDelta() { return takeFresh(delta_); }
+        // Counters and phase times of following calls go to stats, those of the readers they get too (readers' own
+        // stats are used when none is set here). Static patch has no Diff, it counts into base reader's stats.
+        void setStats(Stats *stats) { stats_ = stats; }
 
 
     private:
+        // taken result keeps the pool, member is rebuilt on a new one
+        template<typename T>
+        static T takeFresh(T &result) {
+            T taken = std::move(result);
+            T fresh;
+            std::destroy_at(&result);
+            std::construct_at(&result, std::move(fresh));
+            return taken;
+        }
+
         static constexpr std::size_t s_block_size_4k = (1 << 12);
+        static constexpr std::size_t s_super_block_size = (1 << 20);
+        // super-block is peeked whole into the reader frame, larger ones aren't skipped
+        static constexpr std::size_t s_max_super_block_size = (4 << 20);
+        static constexpr std::size_t s_copy_chunk_size = (1 << 20);
+        // rolled positions between trace counter samples
+        static constexpr std::size_t s_trace_counter_period = (1 << 20);
+
+        template<RollingHash H, io::ByteSource Reader>
+        void hashChunks(Reader &reader);
+        template<RollingHash H, io::ByteSource Reader>
+        void rollDelta(const Signature &signature, Reader &reader);
+        template<RollingHash H, io::ByteSource Reader>
+        void matchChunks(const Signature &signature, Reader &reader);
+        struct CopyRecord {
+            uint64_t base_offset;
+            uint64_t length;
+            uint64_t output_offset;
+        };
+
+        template<io::ByteSource Reader, io::ByteSink Writer>
+        static void applyInstructions(const Delta &delta, Reader &r_base_file, PatchOutput<Writer> &output);
+        static void reverseDeletedChunk(Delta &reverse, const std::vector<ubyte_t> &chunk, uint64_t head,
+                                        uint64_t head_offset, uint64_t tail, uint64_t tail_offset);
+        template<io::ByteSource Reader>
+        static void reverseCopies(std::vector<CopyRecord> copies, Reader &r_base_file, Delta &reverse);
+        // peeked is scratch buffer of the caller, reused across blocks
+        template<io::ByteSource Reader>
+        static bool skipNextBlock(const Signature &signature, Reader &reader, int64_t &last_found_index,
+                                  std::vector<ubyte_t> &peeked);
+        void matchTailBlock(const Signature &signature, std::vector<ubyte_t> &inserts, int64_t &last_found_index);
+        template<io::ByteSource Reader>
+        static bool skipSuperBlock(const Signature &signature, Reader &reader, int64_t &last_found_index,
+                                   std::vector<ubyte_t> &peeked);
+        // sha of whole input, in memory data is hashed without reading the file
+        template<io::ByteSource Reader>
+        static sha256_t readerSha256(Reader &reader);
+        // literal and copied totals of prepared delta, block_count of its signature
+        void countDelta(uint64_t block_count);
 
         Signature signature_;
         Delta delta_;
+        Stats *stats_ = nullptr;
     };
 }
 
+#include "diff_engine.hpp"
+
 #endif //ROLLING_HASH_DIFF_HPP
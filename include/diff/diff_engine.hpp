@@ -0,0 +1,519 @@
+//
+// Template definitions of the signature, delta and patch engine declared in diff.hpp. Included by diff.hpp
+// only. Instantiations for io::FileReader and io::FileWriter are compiled once in diff.cpp.
+
+#ifndef JDIFF_DIFF_ENGINE_HPP
+#define JDIFF_DIFF_ENGINE_HPP
+
+#include <type_traits>
+#include "memory_reader.hpp"
+#include "trace.hpp"
+#include "xxhash64.h"
+
+namespace diff {
+    template<io::ByteSource Reader>
+    sha256_t Diff::readerSha256(Reader &reader) {
+        // bytes in memory are hashed in place, there may be no file behind them
+        if constexpr (std::is_base_of_v<io::MemoryReader, Reader>) {
+            return calculateSha256(reader.data(), reader.size());
+        } else {
+            if constexpr (std::is_polymorphic_v<Reader>) {
+                if (auto *memory = dynamic_cast<const io::MemoryReader *>(&reader)) {
+                    return calculateSha256(memory->data(), memory->size());
+                }
+            }
+            return calculateFileSha256(reader.file_path());
+        }
+    }
+
+    template<io::ByteSource Reader>
+    void Diff::prepareSignatures(Reader &reader, bool sha, RollingHashType rolling_hash,
+                                 uint32_t super_block_factor) {
+        JDIFF_TRACE_SCOPE("prepareSignatures");
+        SharedStats shared_stats(stats_, reader);
+        signature_.clear();
+        signature_.block_size =  reader.max_frame_size();
+        signature_.rolling_hash = rolling_hash;
+        signature_.chunking = reader.chunking();
+
+        // super-blocks group fixed blocks only, content defined chunks are looked up one by one anyway
+        if(signature_.chunking == io::Chunking::Fixed && signature_.block_size > 0) {
+            if(super_block_factor == 0) {
+                super_block_factor = s_super_block_size / signature_.block_size;
+            }
+            if(static_cast<uint64_t>(super_block_factor) * signature_.block_size > s_max_super_block_size) {
+                super_block_factor = 0;
+            }
+            signature_.super_block_factor = super_block_factor > 1 ? super_block_factor : 0;
+        }
+
+        if(sha){
+            signature_.sha = readerSha256(reader);
+        }
+
+        visitRollingHash(rolling_hash, [&]<typename H>(std::type_identity<H>) {
+            hashChunks<H>(reader);
+        });
+    }
+
+    template<RollingHash H, io::ByteSource Reader>
+    void Diff::hashChunks(Reader &reader) {
+        uint64_t index = 0;
+        XXHash64 super_hash(0);
+
+        std::vector<ubyte_t> data_chunk;
+        reader.getNextChunk(data_chunk);
+
+        while (!data_chunk.empty()){
+            signature_.file_size += data_chunk.size();
+            uint32_t rolling_checksum;
+            uint64_t xx_checksum;
+            {
+                ScopedPhase hashing_phase(stats_, Stats::Phase::Hashing);
+                rolling_checksum = H::hashBuffer(data_chunk);
+                xx_checksum = XXHash64::hash(data_chunk.data(), data_chunk.size(),0);
+                if(signature_.super_block_factor > 0 && data_chunk.size() == signature_.block_size) {
+                    super_hash.add(data_chunk.data(), data_chunk.size());
+                }
+            }
+            count(stats_, Stats::Counter::BlocksHashed);
+
+            {
+                ScopedPhase lookup_phase(stats_, Stats::Phase::Lookup);
+                signature_.addSignature(rolling_checksum, xx_checksum, index++);
+            }
+
+            if(signature_.super_block_factor > 0 && data_chunk.size() == signature_.block_size &&
+               (index % signature_.super_block_factor) == 0) {
+                signature_.super_hashes.push_back(super_hash.hash());
+                super_hash = XXHash64(0);
+            }
+
+            reader.getNextChunk(data_chunk);
+        }
+    }
+
+    template<io::ByteSource Reader>
+    void Diff::prepareDelta(const Signature &signature, Reader &reader, bool sha) {
+        JDIFF_TRACE_SCOPE("prepareDelta");
+        SharedStats shared_stats(stats_, reader);
+        delta_.clear();
+        delta_.block_size = signature.block_size;
+        delta_.chunking = signature.chunking;
+        if(sha) {
+            delta_.sha = signature.sha;
+        }
+
+        visitRollingHash(signature.rolling_hash, [&]<typename H>(std::type_identity<H>) {
+            if(signature.chunking == io::Chunking::ContentDefined) {
+                matchChunks<H>(signature, reader);
+            } else {
+                rollDelta<H>(signature, reader);
+            }
+        });
+        countDelta(signature.block_count);
+    }
+
+    template<RollingHash H, io::ByteSource Reader>
+    void Diff::rollDelta(const Signature &signature, Reader &reader) {
+        JDIFF_TRACE_SCOPE("rollDelta");
+        H rhash(delta_.block_size);
+        int64_t last_found_index = -1;
+        std::vector<ubyte_t> inserts;
+        std::vector<ubyte_t> peeked;
+        bool aligned = true;
+        SampledPhases phases(stats_);
+        // weak hits per period show lookup storms, pending literals show literal-heavy regions on the trace
+        uint64_t rolled = 0;
+        uint64_t period_weak_hits = 0;
+
+        while(true){
+            if(aligned && (skipSuperBlock(signature, reader, last_found_index, peeked) ||
+                           skipNextBlock(signature, reader, last_found_index, peeked))){
+                rhash = H(delta_.block_size);
+                continue;
+            }
+
+            phases.next();
+            if(!reader.rollByte()){
+                break;
+            }
+            aligned = false;
+            phases.mark(Stats::Phase::Io);
+
+            rhash.roll(reader.getRolledOutByte(), reader.getLatestByte());
+            inserts.push_back(reader.getLatestByte());
+            auto rolling_checksum = rhash.hash();
+            phases.mark(Stats::Phase::Hashing);
+            count(stats_, Stats::Counter::RollingPositions);
+            if((++rolled % s_trace_counter_period) == 0) {
+                JDIFF_TRACE_COUNTER("weak_hits", period_weak_hits);
+                JDIFF_TRACE_COUNTER("pending_literal_bytes", inserts.size());
+                period_weak_hits = 0;
+            }
+
+            bool weak_hit = signature.signatures.contains(rolling_checksum);
+            phases.mark(Stats::Phase::Lookup);
+            if(weak_hit){
+                count(stats_, Stats::Counter::WeakHits);
+                count(stats_, Stats::Counter::BlocksHashed);
+                period_weak_hits++;
+
+                size_t frame_size = reader.frameSize();
+                uint64_t xx_checksum;
+                {
+                    ScopedPhase hashing_phase(stats_, Stats::Phase::Hashing);
+                    xx_checksum = XXHash64::hash(reader.frameData(), frame_size, 0);
+                }
+                ScopedPhase lookup_phase(stats_, Stats::Phase::Lookup);
+                // window still overlapping previous match can't be reused, its bytes are already taken
+                auto found = signature.signatures.find(rolling_checksum)->second.find(xx_checksum);
+                count(stats_, found != signature.signatures.find(rolling_checksum)->second.end() ?
+                              Stats::Counter::StrongHits : Stats::Counter::FalseWeakHits);
+                // patch walks base blocks in order, so only blocks past the last match can be reused
+                if(inserts.size() >= frame_size &&
+                   found != signature.signatures.find(rolling_checksum)->second.end() &&
+                   static_cast<int64_t>(found->second) > last_found_index){
+                    auto current_index = found->second;
+                    if(current_index > static_cast<uint64_t>(last_found_index+1)){
+                        delta_.deletes[last_found_index+1] = current_index-(last_found_index+1);
+                    }
+
+                    // frame is shorter than block size when short tail block matched right after a skip
+                    inserts.resize(inserts.size() - frame_size);
+
+                    if(!inserts.empty()) {
+                        delta_.inserts[last_found_index+1].assign(inserts.begin(), inserts.end());
+                        inserts.clear();
+                    }
+                    last_found_index = current_index;
+                    aligned = true;
+
+                    continue;
+                }
+            }
+        }
+
+        matchTailBlock(signature, inserts, last_found_index);
+
+        if(static_cast<uint64_t>(last_found_index+1) < signature.block_count) {
+            delta_.deletes[last_found_index+1] = signature.block_count-(last_found_index+1);
+        }
+
+        if(!inserts.empty()){
+            delta_.inserts[last_found_index + 1].assign(inserts.begin(), inserts.end());
+        }
+    }
+
+    template<io::ByteSource Reader>
+    bool Diff::skipNextBlock(const Signature &signature, Reader &reader, int64_t &last_found_index,
+                             std::vector<ubyte_t> &peeked) {
+        uint64_t next_index = last_found_index + 1;
+        if(next_index >= signature.block_hashes.size()) {
+            return false;
+        }
+
+        // short tail block of not aligned base is expected with its own length
+        uint64_t block_size = next_index == signature.block_count - 1 && signature.tailSize() > 0 ?
+                              signature.tailSize() : signature.block_size;
+
+        reader.peek(block_size, peeked);
+        if(peeked.size() != block_size) {
+            return false;
+        }
+        count(reader.stats(), Stats::Counter::BlocksHashed);
+        ScopedPhase hashing_phase(reader.stats(), Stats::Phase::Hashing);
+        if(XXHash64::hash(peeked.data(), peeked.size(), 0) != signature.block_hashes[next_index]) {
+            return false;
+        }
+
+        reader.skip(block_size);
+        last_found_index++;
+        return true;
+    }
+
+    template<io::ByteSource Reader>
+    bool Diff::skipSuperBlock(const Signature &signature, Reader &reader, int64_t &last_found_index,
+                              std::vector<ubyte_t> &peeked) {
+        uint64_t next_index = last_found_index + 1;
+        if(signature.super_block_factor == 0 || (next_index % signature.super_block_factor) != 0) {
+            return false;
+        }
+
+        uint64_t super_index = next_index / signature.super_block_factor;
+        if(super_index >= signature.super_hashes.size()) {
+            return false;
+        }
+
+        // loaded signature may come with any factor, frame isn't grown past the cap
+        uint64_t super_block_size = static_cast<uint64_t>(signature.super_block_factor) * signature.block_size;
+        if(super_block_size > s_max_super_block_size) {
+            return false;
+        }
+        reader.peek(super_block_size, peeked);
+        if(peeked.size() != super_block_size) {
+            return false;
+        }
+        count(reader.stats(), Stats::Counter::BlocksHashed, signature.super_block_factor);
+        ScopedPhase hashing_phase(reader.stats(), Stats::Phase::Hashing);
+        if(XXHash64::hash(peeked.data(), peeked.size(), 0) != signature.super_hashes[super_index]) {
+            return false;
+        }
+
+        reader.skip(super_block_size);
+        last_found_index += signature.super_block_factor;
+        return true;
+    }
+
+    template<RollingHash H, io::ByteSource Reader>
+    void Diff::matchChunks(const Signature &signature, Reader &reader) {
+        JDIFF_TRACE_SCOPE("matchChunks");
+        int64_t last_found_index = -1;
+        std::vector<ubyte_t> inserts;
+
+        std::vector<ubyte_t> data_chunk;
+        reader.getNextChunk(data_chunk);
+
+        while(!data_chunk.empty()){
+            uint32_t rolling_checksum;
+            {
+                ScopedPhase hashing_phase(stats_, Stats::Phase::Hashing);
+                rolling_checksum = H::hashBuffer(data_chunk);
+            }
+            count(stats_, Stats::Counter::BlocksHashed);
+            auto weak = signature.signatures.find(rolling_checksum);
+            if(weak != signature.signatures.end()) {
+                count(stats_, Stats::Counter::WeakHits);
+                uint64_t xx_checksum;
+                {
+                    ScopedPhase hashing_phase(stats_, Stats::Phase::Hashing);
+                    xx_checksum = XXHash64::hash(data_chunk.data(), data_chunk.size(),0);
+                }
+                auto strong = weak->second.find(xx_checksum);
+                count(stats_, strong != weak->second.end() ? Stats::Counter::StrongHits : Stats::Counter::FalseWeakHits);
+                // patch walks base chunks in order, so only chunks past the last match can be reused
+                if(strong != weak->second.end() && static_cast<int64_t>(strong->second) > last_found_index) {
+                    auto current_index = strong->second;
+                    if(current_index > static_cast<uint64_t>(last_found_index+1)){
+                        delta_.deletes[last_found_index+1] = current_index-(last_found_index+1);
+                    }
+
+                    if(!inserts.empty()) {
+                        delta_.inserts[last_found_index+1].assign(inserts.begin(), inserts.end());
+                        inserts.clear();
+                    }
+                    last_found_index = current_index;
+
+                    reader.getNextChunk(data_chunk);
+                    continue;
+                }
+            }
+
+            inserts.insert(inserts.end(), data_chunk.begin(), data_chunk.end());
+            reader.getNextChunk(data_chunk);
+        }
+
+        if(static_cast<uint64_t>(last_found_index+1) < signature.block_count) {
+            delta_.deletes[last_found_index+1] = signature.block_count-(last_found_index+1);
+        }
+
+        if(!inserts.empty()){
+            delta_.inserts[last_found_index + 1].assign(inserts.begin(), inserts.end());
+        }
+    }
+
+    template<io::ByteSink Writer>
+    PatchOutput<Writer>::PatchOutput(Writer &writer, Delta *reverse, Stats *stats)
+            : writer_(writer), reverse_(reverse), stats_(stats) {
+        written_ = 0;
+        if(reverse_) {
+            reverse_->clear();
+            reverse_->format = DeltaFormat::Instructions;
+            sha_.emplace();
+        }
+    }
+
+    template<io::ByteSink Writer>
+    uint64_t PatchOutput<Writer>::append(const ubyte_t *data, size_t size) {
+        uint64_t offset = written_;
+        {
+            ScopedPhase io_phase(stats_, Stats::Phase::Io);
+            writer_.append(data, size);
+        }
+        count(stats_, Stats::Counter::BytesWritten, size);
+        written_ += size;
+        if(reverse_) {
+            sha_->update(data, size);
+        }
+        return offset;
+    }
+
+    template<io::ByteSink Writer>
+    void PatchOutput<Writer>::finish() {
+        if(reverse_) {
+            reverse_->sha = sha_->finish();
+        }
+    }
+
+    template<io::ByteSource Reader, io::ByteSink Writer>
+    void Diff::patchFile(const Delta &delta, Reader &r_base_file, Writer &w_new_file, bool check_sha,
+                         const sha256_t& checksum, Delta *reverse) {
+        JDIFF_TRACE_SCOPE("patchFile");
+        uint64_t index = 0;
+        uint64_t chunks_to_jump;
+        sha256_t sha_checksum;
+
+        if(check_sha && checksum.empty()){
+            sha_checksum = readerSha256(r_base_file);
+        } else {
+            sha_checksum = checksum;
+        }
+
+        if(check_sha && !compareSha(delta.sha, sha_checksum)) {
+            throw std::invalid_argument("Delta hash doesn't match to the base file!");
+        }
+
+        Stats *stats = r_base_file.stats();
+        PatchOutput<Writer> output(w_new_file, reverse, stats);
+
+        if(delta.format == DeltaFormat::Instructions) {
+            applyInstructions(delta, r_base_file, output);
+            output.finish();
+            return;
+        }
+
+        std::vector<ubyte_t> data_chunk;
+        r_base_file.getNextChunk(data_chunk);
+
+        while(!data_chunk.empty()){
+            chunks_to_jump = 1;
+            auto deleted = delta.deletes.find(index);
+            auto extension = deleted != delta.deletes.end() ? delta.extensions.find(index) : delta.extensions.end();
+            uint64_t head = 0;
+            uint64_t head_offset = 0;
+
+            if(extension != delta.extensions.end() && extension->second.head > 0){
+                head = std::min<size_t>(extension->second.head, data_chunk.size());
+                head_offset = output.append(data_chunk.data(), head);
+            }
+
+            auto inserted = delta.inserts.find(index);
+            if(inserted != delta.inserts.end()){
+                output.append(inserted->second.data(), inserted->second.size());
+                count(stats, Stats::Counter::LiteralBytes, inserted->second.size());
+            }
+
+            if(deleted != delta.deletes.end()) {
+                chunks_to_jump = deleted->second;
+            } else {
+                count(stats, Stats::Counter::CopiedBlocks);
+                uint64_t chunk_offset = output.append(data_chunk);
+                if(reverse) {
+                    reverse->addCopy(chunk_offset, data_chunk.size());
+                }
+            }
+
+            for(uint64_t i = 0; i < chunks_to_jump; i++, index++){
+                uint64_t tail = 0;
+                uint64_t tail_offset = 0;
+                // tail of extended match is the end of the last deleted block
+                if(i + 1 == chunks_to_jump && extension != delta.extensions.end() && extension->second.tail > 0) {
+                    tail = std::min<size_t>(extension->second.tail, data_chunk.size());
+                    tail_offset = output.append(data_chunk.data() + data_chunk.size() - tail, tail);
+                }
+                if(reverse && deleted != delta.deletes.end()) {
+                    reverseDeletedChunk(*reverse, data_chunk, i == 0 ? head : 0, head_offset, tail, tail_offset);
+                }
+                r_base_file.getNextChunk(data_chunk);
+            }
+        }
+
+        auto inserted = delta.inserts.find(index);
+        if(inserted != delta.inserts.end()){
+            output.append(inserted->second.data(), inserted->second.size());
+            count(stats, Stats::Counter::LiteralBytes, inserted->second.size());
+        }
+        output.finish();
+    }
+
+    template<io::ByteSource Reader, io::ByteSink Writer>
+    void Diff::applyInstructions(const Delta &delta, Reader &r_base_file, PatchOutput<Writer> &output) {
+        JDIFF_TRACE_SCOPE("applyInstructions");
+        std::vector<CopyRecord> copies;
+        std::vector<ubyte_t> data;
+
+        for(const auto &instruction : delta.instructions) {
+            if(instruction.type == Instruction::Type::Literal) {
+                output.append(delta.literals.data() + instruction.offset, instruction.length);
+                count(r_base_file.stats(), Stats::Counter::LiteralBytes, instruction.length);
+                continue;
+            }
+            count(r_base_file.stats(), Stats::Counter::CopiedBytes, instruction.length);
+
+            for(uint64_t copied = 0; copied < instruction.length;) {
+                auto length = std::min<uint64_t>(s_copy_chunk_size, instruction.length - copied);
+                r_base_file.readAt(instruction.offset + copied, length, data);
+                if(data.size() != length) {
+                    throw std::invalid_argument("Delta copies data beyond the base file!");
+                }
+                uint64_t output_offset = output.append(data);
+                if(output.reverse() && copied == 0) {
+                    copies.push_back({instruction.offset, instruction.length, output_offset});
+                }
+                copied += length;
+            }
+        }
+
+        if(output.reverse()) {
+            reverseCopies(copies, r_base_file, *output.reverse());
+        }
+    }
+
+    template<io::ByteSource Reader>
+    void Diff::reverseCopies(std::vector<CopyRecord> copies, Reader &r_base_file, Delta &reverse) {
+        JDIFF_TRACE_SCOPE("reverseCopies");
+        std::sort(copies.begin(), copies.end(), [](const CopyRecord &a, const CopyRecord &b) {
+            return a.base_offset < b.base_offset;
+        });
+
+        // walks the base, each byte is copied back from the output when some copy covers it, read otherwise
+        uint64_t position = 0;
+        size_t next = 0;
+        std::vector<ubyte_t> data;
+        while(true) {
+            uint64_t covered_end = position;
+            uint64_t covered_output = 0;
+            for(; next < copies.size() && copies[next].base_offset <= position; next++) {
+                uint64_t end = copies[next].base_offset + copies[next].length;
+                if(end > covered_end) {
+                    covered_end = end;
+                    covered_output = copies[next].output_offset + (position - copies[next].base_offset);
+                }
+            }
+            if(covered_end > position) {
+                reverse.addCopy(covered_output, covered_end - position);
+                position = covered_end;
+                continue;
+            }
+
+            uint64_t gap_end = next < copies.size() ? copies[next].base_offset : UINT64_MAX;
+            r_base_file.readAt(position, std::min<uint64_t>(s_copy_chunk_size, gap_end - position), data);
+            reverse.addLiteral(data.data(), data.size());
+            position += data.size();
+            if(data.empty() && next >= copies.size()) {
+                break;
+            }
+            if(data.empty()) {
+                throw std::invalid_argument("Delta copies data beyond the base file!");
+            }
+        }
+    }
+
+    extern template void Diff::prepareSignatures<io::FileReader>(io::FileReader &, bool, RollingHashType, uint32_t);
+    extern template void Diff::prepareDelta<io::FileReader>(const Signature &, io::FileReader &, bool);
+    extern template void Diff::patchFile<io::FileReader, io::FileWriter>(const Delta &, io::FileReader &,
+                                                                         io::FileWriter &, bool, const sha256_t &,
+                                                                         Delta *);
+}
+
+#endif //JDIFF_DIFF_ENGINE_HPP
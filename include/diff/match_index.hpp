@@ -0,0 +1,57 @@
+//
+// Seed index of a whole base file for two-file diffs. Every stride-th offset of the base is hashed
+// over a short seed window, target is rolled byte by byte and seed hits are verified and extended
+// in both directions, so matches are found at any offset and of any length.
+
+#ifndef JDIFF_MATCH_INDEX_HPP
+#define JDIFF_MATCH_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace diff {
+
+    class MatchIndex {
+    public:
+        struct Entry {
+            uint32_t hash;
+            uint64_t offset;
+        };
+
+        struct Match {
+            uint64_t target_offset = 0;
+            uint64_t base_offset = 0;
+            uint64_t length = 0;
+        };
+
+        // Index is built on slices of the base in parallel, 0 threads means hardware concurrency
+        explicit MatchIndex(const std::vector<unsigned char> &base, unsigned threads = 0);
+
+        // Longest verified match of the seed at target_offset, extended backward no further than
+        // min_target_offset. Returns zero length match when no seed candidate verifies.
+        Match find(const std::vector<unsigned char> &target, uint64_t target_offset, uint32_t seed_hash,
+                   uint64_t min_target_offset) const;
+
+        uint64_t stride() const { return stride_; }
+        size_t size() const { return entries_.size(); }
+
+        static constexpr inline uint32_t s_seed_size = 16;
+
+    private:
+        void indexSlice(uint64_t first_seed, uint64_t last_seed, std::vector<Entry> &entries) const;
+
+        // caps index memory (16 bytes per entry), larger bases get a sparser index
+        static constexpr inline uint64_t s_max_entries = (1 << 22);
+        // popular seeds (runs of zeros etc.) are verified only this many times per position
+        static constexpr inline size_t s_max_candidates = 8;
+        // threads below this slice size cost more to start than they save
+        static constexpr inline uint64_t s_min_slice_size = (1 << 20);
+
+        const std::vector<unsigned char> &base_;
+        std::vector<Entry> entries_;
+        uint64_t stride_;
+    };
+}
+
+#endif //JDIFF_MATCH_INDEX_HPP
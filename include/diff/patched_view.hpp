@@ -0,0 +1,43 @@
+//
+// Random access to the file a delta produces, served from base and delta on demand. Output offsets of all
+// copy and literal instructions are indexed once, so read() touches only the base ranges it returns.
+
+#ifndef JDIFF_PATCHED_VIEW_HPP
+#define JDIFF_PATCHED_VIEW_HPP
+
+#include <cstdint>
+#include <vector>
+#include "diff.hpp"
+
+namespace diff {
+
+    struct ByteRange {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    class PatchedView {
+    public:
+        // Block delta is indexed by block math, so base size is needed (content defined chunks aren't supported)
+        PatchedView(Delta delta, io::FileReader &r_base_file, uint64_t base_size);
+
+        // Bytes [offset, offset + length) of patched file, shorter at its end
+        std::vector<ubyte_t> read(uint64_t offset, uint64_t length) const;
+
+        // Sparse patched file - full size, only given ranges written, the rest are holes read as zeros
+        void writeRanges(const std::vector<ByteRange> &ranges, io::FileWriter &writer) const;
+
+        uint64_t size() const { return size_; }
+
+    private:
+        static constexpr std::size_t s_write_chunk_size = (1 << 20);
+
+        Delta delta_;
+        io::FileReader &r_base_file_;
+        // output offset where each instruction starts
+        std::vector<uint64_t> starts_;
+        uint64_t size_;
+    };
+}
+
+#endif //JDIFF_PATCHED_VIEW_HPP
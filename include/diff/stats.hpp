@@ -0,0 +1,151 @@
+//
+// Counters and phase timers of a run. Diff and FileReader get optional pointer to it, without one every
+// probe is a single null check. Per-byte loops time only every s_sample_period-th iteration and scale it.
+
+#ifndef JDIFF_STATS_HPP
+#define JDIFF_STATS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace diff {
+
+    class Stats {
+    public:
+        enum class Counter : uint8_t {
+            BytesRead = 0,
+            BytesWritten,
+            BlocksHashed,
+            RollingPositions,
+            WeakHits,
+            StrongHits,
+            FalseWeakHits,
+            LiteralBytes,
+            CopiedBlocks,
+            CopiedBytes,
+            Count
+        };
+
+        enum class Phase : uint8_t {
+            Io = 0,
+            Hashing,
+            Lookup,
+            Serialization,
+            Count
+        };
+
+        void add(Counter counter, uint64_t value = 1) { counters_[static_cast<size_t>(counter)] += value; }
+        // takes back what a later step of the run undid, e.g. literal bytes turned into copies
+        void remove(Counter counter, uint64_t value) { counters_[static_cast<size_t>(counter)] -= value; }
+        void addTime(Phase phase, uint64_t ns) { phases_ns_[static_cast<size_t>(phase)] += ns; }
+        uint64_t count(Counter counter) const { return counters_[static_cast<size_t>(counter)]; }
+        uint64_t nanoseconds(Phase phase) const { return phases_ns_[static_cast<size_t>(phase)]; }
+
+        // wall_ns is the whole run, time outside of phases is reported as other
+        void print(std::ostream &os, uint64_t wall_ns) const;
+        void printJson(std::ostream &os, uint64_t wall_ns) const;
+
+        static const char * counterName(Counter counter);
+        static const char * phaseName(Phase phase);
+        static long peakRssKib();
+
+        static constexpr inline uint32_t s_sample_period = 64;
+
+    private:
+        std::array<uint64_t, static_cast<size_t>(Counter::Count)> counters_{};
+        std::array<uint64_t, static_cast<size_t>(Phase::Count)> phases_ns_{};
+    };
+
+    inline void count(Stats *stats, Stats::Counter counter, uint64_t value = 1) {
+        if (stats) {
+            stats->add(counter, value);
+        }
+    }
+
+    // Adds time of its scope to the phase
+    class ScopedPhase {
+    public:
+        ScopedPhase(Stats *stats, Stats::Phase phase) : stats_(stats), phase_(phase) {
+            if (stats_) {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~ScopedPhase() {
+            if (stats_) {
+                stats_->addTime(phase_, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_).count()));
+            }
+        }
+
+        ScopedPhase(const ScopedPhase &) = delete;
+        ScopedPhase & operator=(const ScopedPhase &) = delete;
+
+    private:
+        Stats *stats_;
+        Stats::Phase phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // One sink for a Diff call and the reader it works on - Diff's stats, or reader's when Diff has none. Both are
+    // pointed to it for the scope of the call and get their own back at its end.
+    template<typename Source>
+    class SharedStats {
+    public:
+        SharedStats(Stats *&sink, Source &source)
+                : sink_(sink), source_(source), saved_sink_(sink), saved_source_(source.stats()) {
+            Stats *shared = sink ? sink : source.stats();
+            sink_ = shared;
+            source_.setStats(shared);
+        }
+
+        ~SharedStats() {
+            sink_ = saved_sink_;
+            source_.setStats(saved_source_);
+        }
+
+        SharedStats(const SharedStats &) = delete;
+        SharedStats & operator=(const SharedStats &) = delete;
+
+    private:
+        Stats *&sink_;
+        Source &source_;
+        Stats *saved_sink_;
+        Stats *saved_source_;
+    };
+
+    // Splits iterations of per-byte loop into phases. Clock costs more than the iteration itself, so only
+    // every s_sample_period-th one is timed and counted s_sample_period times.
+    class SampledPhases {
+    public:
+        explicit SampledPhases(Stats *stats) : stats_(stats) {}
+
+        void next() {
+            sampling_ = stats_ && (++iteration_ % Stats::s_sample_period) == 0;
+            if (sampling_) {
+                last_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        // time since previous mark (or next) goes to the phase
+        void mark(Stats::Phase phase) {
+            if (!sampling_) {
+                return;
+            }
+            auto now = std::chrono::steady_clock::now();
+            stats_->addTime(phase, Stats::s_sample_period * static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count()));
+            last_ = now;
+        }
+
+    private:
+        Stats *stats_;
+        bool sampling_ = false;
+        uint64_t iteration_ = 0;
+        std::chrono::steady_clock::time_point last_;
+    };
+}
+
+#endif //JDIFF_STATS_HPP
@@ -0,0 +1,103 @@
+//
+// Chrome trace (chrome://tracing, Perfetto) of a run: scoped spans and counters recorded by the
+// JDIFF_TRACE_* macros. Built with JDIFF_WITH_TRACE (CMake option JDIFF_TRACE), otherwise the macros
+// expand to nothing. Recording is switched on at runtime by start(), until then a span is one flag check.
+
+#ifndef JDIFF_TRACE_HPP
+#define JDIFF_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace diff {
+
+    class Tracer {
+    public:
+        static Tracer & instance() {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        // Starts recording, events are written to file_path by stop()
+        void start(const std::string &file_path);
+        void stop();
+        bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+        void span(const char *name, const char *category, std::chrono::steady_clock::time_point begin,
+                  std::chrono::steady_clock::time_point end);
+        void counter(const char *name, uint64_t value);
+
+        // reads shorter than this are common and uninteresting, only stalls are recorded
+        static constexpr inline uint64_t s_min_io_span_ns = 50000;
+
+    private:
+        struct Event {
+            const char *name;
+            const char *category;
+            char phase;
+            uint32_t thread;
+            uint64_t timestamp_ns;
+            uint64_t value; // duration of span, value of counter
+        };
+
+        Tracer() = default;
+        uint64_t sinceStart(std::chrono::steady_clock::time_point time) const;
+
+        std::atomic<bool> enabled_ = false;
+        std::mutex mutex_;
+        std::vector<Event> events_;
+        std::string file_path_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    class TraceSpan {
+    public:
+        TraceSpan(const char *name, const char *category, uint64_t min_ns = 0)
+                : name_(name), category_(category), min_ns_(min_ns), enabled_(Tracer::instance().enabled()) {
+            if (enabled_) {
+                begin_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~TraceSpan() {
+            if (!enabled_) {
+                return;
+            }
+            auto end = std::chrono::steady_clock::now();
+            if (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin_).count()) >= min_ns_) {
+                Tracer::instance().span(name_, category_, begin_, end);
+            }
+        }
+
+        TraceSpan(const TraceSpan &) = delete;
+        TraceSpan & operator=(const TraceSpan &) = delete;
+
+    private:
+        const char *name_;
+        const char *category_;
+        uint64_t min_ns_;
+        bool enabled_;
+        std::chrono::steady_clock::time_point begin_;
+    };
+}
+
+#define JDIFF_TRACE_CONCAT_INNER(a, b) a##b
+#define JDIFF_TRACE_CONCAT(a, b) JDIFF_TRACE_CONCAT_INNER(a, b)
+
+#ifdef JDIFF_WITH_TRACE
+#define JDIFF_TRACE_SCOPE(name) diff::TraceSpan JDIFF_TRACE_CONCAT(trace_span_, __LINE__)(name, "jdiff")
+#define JDIFF_TRACE_IO_SCOPE(name) diff::TraceSpan JDIFF_TRACE_CONCAT(trace_span_, __LINE__)(name, "io", \
+        diff::Tracer::s_min_io_span_ns)
+#define JDIFF_TRACE_COUNTER(name, value) \
+    do { if (diff::Tracer::instance().enabled()) diff::Tracer::instance().counter(name, value); } while (0)
+#else
+#define JDIFF_TRACE_SCOPE(name) do {} while (0)
+#define JDIFF_TRACE_IO_SCOPE(name) do {} while (0)
+#define JDIFF_TRACE_COUNTER(name, value) do {} while (0)
+#endif
+
+#endif //JDIFF_TRACE_HPP
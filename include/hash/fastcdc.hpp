@@ -0,0 +1,89 @@
+//
+// FastCDC content defined chunking based on "FastCDC: a Fast and Efficient Content-Defined
+// Chunking Approach for Data Deduplication" (Xia et al., USENIX ATC'16)
+// https://www.usenix.org/system/files/conference/atc16/atc16-paper-xia.pdf
+//
+
+#ifndef JDIFF_FASTCDC_HPP
+#define JDIFF_FASTCDC_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include "rolling_hash.hpp"
+
+namespace fastcdc_detail {
+
+    constexpr std::array<uint64_t, 256> makeGearTable(uint64_t seed) {
+        std::array<uint64_t, 256> table{};
+        for (auto &value : table) {
+            value = rolling_hash_detail::splitMix64(seed);
+        }
+        return table;
+    }
+}
+
+class FastCDC {
+public:
+
+    FastCDC() = delete;
+
+    // Chunk sizes are derived from the average, so signature and patch side always cut the same way. Average is
+    // clamped before rounding up, so its power of two and 8 times larger max size both fit in 32 bits.
+    explicit FastCDC(uint32_t avg_size) {
+        avg_size_ = std::bit_ceil(std::clamp<uint32_t>(avg_size, s_min_avg_size, s_max_avg_size));
+        min_size_ = avg_size_ / 4;
+        max_size_ = avg_size_ * 8;
+
+        auto bits = static_cast<unsigned>(std::countr_zero(avg_size_));
+        mask_small_ = topBits(bits + 1);
+        mask_large_ = topBits(bits - 1);
+    }
+
+    // Returns length of the first chunk in data, data shorter than max_size() is treated as end of input
+    size_t cutPoint(const unsigned char *data, size_t size) const {
+        if (size <= min_size_) {
+            return size;
+        }
+
+        size_t limit = std::min<size_t>(size, max_size_);
+        size_t normal = std::min<size_t>(limit, avg_size_);
+        uint64_t fingerprint = 0;
+        size_t i = min_size_;
+
+        for (; i < normal; i++) {
+            fingerprint = (fingerprint << 1) + s_gear[data[i]];
+            if (!(fingerprint & mask_small_)) return i + 1;
+        }
+
+        for (; i < limit; i++) {
+            fingerprint = (fingerprint << 1) + s_gear[data[i]];
+            if (!(fingerprint & mask_large_)) return i + 1;
+        }
+
+        return limit;
+    }
+
+    uint32_t min_size() const { return min_size_; }
+    uint32_t avg_size() const { return avg_size_; }
+    uint32_t max_size() const { return max_size_; }
+
+private:
+    static constexpr uint64_t topBits(unsigned bits) {
+        return bits == 0 ? 0 : ~uint64_t{0} << (64 - bits);
+    }
+
+    static constexpr inline uint32_t s_min_avg_size = 64;
+    static constexpr inline uint32_t s_max_avg_size = uint32_t{1} << 28;
+    static constexpr inline std::array<uint64_t, 256> s_gear = fastcdc_detail::makeGearTable(0x4765'6172'4344'4321ULL);
+
+    uint32_t min_size_;
+    uint32_t avg_size_;
+    uint32_t max_size_;
+    uint64_t mask_small_;
+    uint64_t mask_large_;
+};
+
+#endif //JDIFF_FASTCDC_HPP
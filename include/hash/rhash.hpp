@@ -15,22 +15,27 @@ public:
 
     RHash() = delete;
 
-    explicit RHash(uint16_t block_size) {
+    explicit RHash(uint32_t block_size) {
         block_size_ = block_size;
+        counter_ = 0;
         a_ = 0;
         sum_ = 0;
     }
 
     void roll(char oldest_byte, char next_byte) {
+        // Bytes are summed as unsigned values so rolled hash always equals hashBuffer() of the same window
+        auto oldest = static_cast<uint8_t>(oldest_byte);
+        auto next = static_cast<uint8_t>(next_byte);
+
         if (counter_ < block_size_) {
             counter_++;
         } else {
-            a_ -= oldest_byte;
-            sum_ -= (block_size_*oldest_byte);
+            a_ += M - oldest;
+            sum_ += M - ((block_size_ % M) * oldest) % M;
         }
-        a_ += (uint16_t)next_byte;
-        sum_ += a_;
+        a_ += next;
         moduloM(a_);
+        sum_ += a_;
         moduloM(sum_);
     }
 
@@ -38,32 +43,32 @@ public:
         return a_ | (sum_ << 16);
     }
 
-    static uint32_t hashBuffer(std::vector<unsigned char> buffer) {
-        uint16_t a = 0;
-        uint16_t sum = 0;
+    static uint32_t hashBuffer(const std::vector<unsigned char> &buffer) {
+        uint32_t a = 0;
+        uint32_t sum = 0;
 
         for (const auto& byte : buffer){
-            a += (uint16_t)byte;
-            sum += a;
+            a += byte;
             moduloM(a);
+            sum += a;
             moduloM(sum);
         }
 
         return a | (sum << 16);
     }
 
-    static inline void moduloM(uint16_t &val){
+    static inline void moduloM(uint32_t &val){
         val %= M;
     }
 
-    static constexpr inline uint16_t M = 65521;
+    static constexpr inline uint32_t M = 65521;
 
 private:
-    uint16_t a_;
-    uint16_t sum_;
+    uint32_t a_;
+    uint32_t sum_;
 
-    uint16_t block_size_;
-    uint16_t counter_;
+    uint32_t block_size_;
+    uint32_t counter_;
 };
 
 #endif //JDIFF_RHASH_HPP
@@ -0,0 +1,187 @@
+//
+// Rolling hash families usable as the weak checksum of signatures and deltas.
+// RHash (rsync/Adler) is the default, RabinKarpHash and BuzHash trade a few more
+// instructions per byte for a much better distribution on text and structured data.
+//
+
+#ifndef JDIFF_ROLLING_HASH_HPP
+#define JDIFF_ROLLING_HASH_HPP
+
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "rhash.hpp"
+
+enum class RollingHashType : uint8_t {
+    Adler = 0,
+    RabinKarp = 1,
+    BuzHash = 2
+};
+
+template<typename H>
+concept RollingHash = std::constructible_from<H, uint32_t> &&
+        requires(H h, const H ch, char byte, const std::vector<unsigned char> &buffer) {
+            h.roll(byte, byte);
+            { ch.hash() } -> std::same_as<uint32_t>;
+            { H::hashBuffer(buffer) } -> std::same_as<uint32_t>;
+        };
+
+namespace rolling_hash_detail {
+
+    // splitmix64 - deterministic, so tables are identical on every host and in every signature
+    constexpr uint64_t splitMix64(uint64_t &state) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    constexpr std::array<uint32_t, 256> makeByteTable(uint64_t seed) {
+        std::array<uint32_t, 256> table{};
+        for (auto &value : table) {
+            value = static_cast<uint32_t>(splitMix64(seed) >> 32);
+        }
+        return table;
+    }
+
+    constexpr uint32_t rotateLeft(uint32_t value, unsigned bits) {
+        bits &= 31;
+        return bits ? (value << bits) | (value >> (32 - bits)) : value;
+    }
+}
+
+class RabinKarpHash {
+public:
+
+    RabinKarpHash() = delete;
+
+    explicit RabinKarpHash(uint32_t block_size) {
+        block_size_ = block_size;
+        counter_ = 0;
+        hash_ = 0;
+        // weight of the oldest byte in the window - base^(block_size-1)
+        out_factor_ = 1;
+        uint32_t base = s_base;
+        for (uint32_t exponent = block_size > 0 ? block_size - 1 : 0; exponent > 0; exponent >>= 1) {
+            if (exponent & 1) out_factor_ *= base;
+            base *= base;
+        }
+    }
+
+    void roll(char oldest_byte, char next_byte) {
+        if (counter_ < block_size_) {
+            counter_++;
+        } else {
+            hash_ -= out_factor_ * s_table[static_cast<uint8_t>(oldest_byte)];
+        }
+        hash_ = hash_ * s_base + s_table[static_cast<uint8_t>(next_byte)];
+    }
+
+    uint32_t hash() const {
+        return hash_;
+    }
+
+    static uint32_t hashBuffer(const std::vector<unsigned char> &buffer) {
+        uint32_t hash = 0;
+        for (const auto& byte : buffer) {
+            hash = hash * s_base + s_table[byte];
+        }
+        return hash;
+    }
+
+private:
+    static constexpr inline uint32_t s_base = 0x01000193;
+    static constexpr inline std::array<uint32_t, 256> s_table = rolling_hash_detail::makeByteTable(0x5261'6269'6E4B'6172ULL);
+
+    uint32_t hash_;
+    uint32_t out_factor_;
+
+    uint32_t block_size_;
+    uint32_t counter_;
+};
+
+class BuzHash {
+public:
+
+    BuzHash() = delete;
+
+    explicit BuzHash(uint32_t block_size) {
+        block_size_ = block_size;
+        counter_ = 0;
+        hash_ = 0;
+    }
+
+    void roll(char oldest_byte, char next_byte) {
+        hash_ = rolling_hash_detail::rotateLeft(hash_, 1);
+        if (counter_ < block_size_) {
+            counter_++;
+        } else {
+            hash_ ^= rolling_hash_detail::rotateLeft(s_table[static_cast<uint8_t>(oldest_byte)], block_size_);
+        }
+        hash_ ^= s_table[static_cast<uint8_t>(next_byte)];
+    }
+
+    uint32_t hash() const {
+        return hash_;
+    }
+
+    static uint32_t hashBuffer(const std::vector<unsigned char> &buffer) {
+        uint32_t hash = 0;
+        for (const auto& byte : buffer) {
+            hash = rolling_hash_detail::rotateLeft(hash, 1) ^ s_table[byte];
+        }
+        return hash;
+    }
+
+private:
+    static constexpr inline std::array<uint32_t, 256> s_table = rolling_hash_detail::makeByteTable(0x4275'7A48'6173'6821ULL);
+
+    uint32_t hash_;
+
+    uint32_t block_size_;
+    uint32_t counter_;
+};
+
+static_assert(RollingHash<RHash>);
+static_assert(RollingHash<RabinKarpHash>);
+static_assert(RollingHash<BuzHash>);
+
+// Calls f with a default constructed tag of the rolling hash class selected at runtime,
+// so templated engines can be instantiated for every family from a single call site.
+template<typename F>
+decltype(auto) visitRollingHash(RollingHashType type, F &&f) {
+    switch (type) {
+        case RollingHashType::Adler:
+            return f(std::type_identity<RHash>{});
+        case RollingHashType::RabinKarp:
+            return f(std::type_identity<RabinKarpHash>{});
+        case RollingHashType::BuzHash:
+            return f(std::type_identity<BuzHash>{});
+    }
+    throw std::invalid_argument("Unknown rolling hash type!");
+}
+
+inline RollingHashType rollingHashFromString(const std::string &name) {
+    if (name == "adler") return RollingHashType::Adler;
+    if (name == "rabin-karp") return RollingHashType::RabinKarp;
+    if (name == "buzhash") return RollingHashType::BuzHash;
+    throw std::invalid_argument(std::string("Unknown rolling hash " + name + "!"));
+}
+
+inline std::string rollingHashName(RollingHashType type) {
+    switch (type) {
+        case RollingHashType::Adler:
+            return "adler";
+        case RollingHashType::RabinKarp:
+            return "rabin-karp";
+        case RollingHashType::BuzHash:
+            return "buzhash";
+    }
+    return "unknown";
+}
+
+#endif //JDIFF_ROLLING_HASH_HPP
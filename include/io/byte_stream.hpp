@@ -0,0 +1,41 @@
+//
+// What the diff engine needs from its input and output. The engine is a template over these, so it is
+// compiled separately for every reader type: calls to final readers are direct and inlined, io::FileReader
+// and io::FileWriter references keep working through their virtual methods.
+
+#ifndef JDIFF_BYTE_STREAM_HPP
+#define JDIFF_BYTE_STREAM_HPP
+
+#include <concepts>
+#include <cstdint>
+#include <vector>
+#include "file_reader.hpp"
+
+namespace io {
+
+    template<typename T>
+    concept ByteSource = requires(T &source, const T &const_source, std::vector<unsigned char> &buffer,
+                                  size_t length, uint64_t offset, diff::Stats *stats) {
+        { source.rollByte() } -> std::same_as<bool>;
+        source.getNextChunk(buffer);
+        source.peek(length, buffer);
+        source.skip(length);
+        source.readAt(offset, length, buffer);
+        { const_source.frameData() } -> std::same_as<const unsigned char *>;
+        { const_source.frameSize() } -> std::same_as<size_t>;
+        { const_source.getLatestByte() } -> std::same_as<char>;
+        { const_source.getRolledOutByte() } -> std::same_as<char>;
+        { const_source.max_frame_size() } -> std::convertible_to<uint32_t>;
+        { const_source.chunking() } -> std::same_as<Chunking>;
+        { const_source.file_path() } -> std::convertible_to<std::string>;
+        { const_source.stats() } -> std::same_as<diff::Stats *>;
+        source.setStats(stats);
+    };
+
+    template<typename T>
+    concept ByteSink = requires(T &sink, const unsigned char *data, size_t size) {
+        sink.append(data, size);
+    };
+}
+
+#endif //JDIFF_BYTE_STREAM_HPP
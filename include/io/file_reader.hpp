@@ -6,56 +6,117 @@
 
 #include <iostream>
 #include <vector>
-#include <list>
 #include <fstream>
 #include <filesystem>
 #include "rhash.hpp"
+#include "fastcdc.hpp"
+#include "stats.hpp"
 
 namespace io {
 
+    enum class Chunking : uint8_t {
+        Fixed = 0,
+        ContentDefined = 1
+    };
+
     class FileReader {
     public:
         FileReader();
-        explicit FileReader(const std::string &file_path, uint16_t block_size);
+        explicit FileReader(const std::string &file_path, uint32_t block_size, Chunking chunking = Chunking::Fixed);
         explicit FileReader(const std::string &file_path);
         virtual ~FileReader();
 
         virtual bool rollByte();
-        virtual std::vector<unsigned char> getNextChunk();
+        // Buffer filling reads reuse capacity of the buffer, hot loops keep one and allocate nothing per block.
+        // Chunk is empty at the end of file.
+        virtual void getNextChunk(std::vector<unsigned char> &chunk);
+        virtual void peek(size_t length, std::vector<unsigned char> &data);
+        virtual void skip(size_t length);
+        virtual void readAt(uint64_t offset, size_t length, std::vector<unsigned char> &data);
+        std::vector<unsigned char> getNextChunk();
+        std::vector<unsigned char> peek(size_t length);
+        std::vector<unsigned char> readAt(uint64_t offset, size_t length);
+
+        // Rolled window is contiguous, valid until next rollByte() or skip()
+        const unsigned char * frameData() const { return frame_.data() + frame_head_; }
+        size_t frameSize() const { return frame_size_; }
         std::vector<unsigned char> getCurrentFrame();
-        char getLatestByte();
-        char getRolledOutByte() const;
+        char getLatestByte() const { return static_cast<char>(frameData()[frame_size_ - 1]); }
+        char getRolledOutByte() const { return rolled_out_; }
 
-        std::vector<uint8_t> getBuffer();
+        virtual std::vector<uint8_t> getBuffer();
         const std::string & file_path() const { return file_path_; }
-        const uint16_t & max_frame_size() const { return max_frame_size_; }
+        const uint32_t & max_frame_size() const { return max_frame_size_; }
+        Chunking chunking() const { return chunking_; }
+        // bytes and I/O time of reads are added to stats when set, rollByte() reads are timed by its caller
+        void setStats(diff::Stats *stats) { stats_ = stats; }
+        diff::Stats * stats() const { return stats_; }
 
         static inline bool doesFileExist(const std::string &file_path) {
             std::ifstream is(file_path);
             return is.good();
         }
 
-        static uint16_t calculateBlockSize(uintmax_t file_size){
-            uint16_t block_size = s_max_block_size;
+        static uint32_t calculateBlockSize(uintmax_t file_size){
+            uint32_t block_size = s_default_block_size;
 
-            while ((file_size / s_min_block_count) < block_size) {
+            // at least one byte, empty and single byte inputs would end with zero
+            while ((file_size / s_min_block_count) < block_size && block_size > 1) {
                 block_size /= 2;
             }
 
+            // huge files get larger blocks, so signature stays below s_max_block_count entries
+            while ((file_size / block_size) > s_max_block_count && block_size < s_max_block_size) {
+                block_size *= 2;
+            }
+
             return block_size;
         }
 
     protected:
-        std::list<char> frame_;
+        // Appends byte to rolled window, the oldest one is rolled out of full window
+        void pushFrameByte(char byte) {
+            if (frame_.empty()) {
+                frame_.resize(2 * static_cast<size_t>(max_frame_size_));
+            }
+
+            size_t position;
+            if (frame_size_ == max_frame_size_) {
+                rolled_out_ = static_cast<char>(frame_[frame_head_]);
+                position = frame_head_;
+                frame_head_ = frame_head_ + 1 == max_frame_size_ ? 0 : frame_head_ + 1;
+            } else {
+                position = (frame_head_ + frame_size_) % max_frame_size_;
+                frame_size_++;
+            }
+            frame_[position] = static_cast<unsigned char>(byte);
+            frame_[position + max_frame_size_] = static_cast<unsigned char>(byte);
+        }
+        void clearFrame();
+
+        // ring of max_frame_size_ bytes stored twice, so window starting anywhere is contiguous
+        std::vector<unsigned char> frame_;
+        size_t frame_head_ = 0;
+        size_t frame_size_ = 0;
         char rolled_out_;
-        uint16_t max_frame_size_;
+        uint32_t max_frame_size_;
+        Chunking chunking_ = Chunking::Fixed;
+        diff::Stats *stats_ = nullptr;
+        std::string file_path_;
 
     private:
+        void getNextContentDefinedChunk(std::vector<unsigned char> &chunk);
+
         static constexpr inline uint8_t s_min_block_count = 2;
-        static constexpr inline uint16_t s_max_block_size = 1024*4;
+        static constexpr inline uint32_t s_default_block_size = 1024*4;
+        static constexpr inline uint32_t s_max_block_size = 1024*1024*64;
+        static constexpr inline uint64_t s_max_block_count = 1024*1024;
 
-        std::string file_path_;
         std::ifstream is_;
+
+        // read ahead window of content defined chunking, chunks are cut from pending_offset_
+        std::vector<unsigned char> pending_;
+        size_t pending_offset_ = 0;
     };
 }
 
@@ -15,6 +15,7 @@ namespace io {
     class FileWriter {
     private:
         std::ofstream os_;
+        std::string file_path_;
 
     public:
         FileWriter() = default;
@@ -22,7 +23,11 @@ namespace io {
         FileWriter(const FileWriter &fileManager) = delete;
         virtual ~FileWriter();
 
-        virtual void append(const std::vector<unsigned char> &data);
+        virtual void append(const unsigned char *data, size_t size);
+        void append(const std::vector<unsigned char> &data) { append(data.data(), data.size()); }
+        // Positional write, gaps left behind are holes of sparse file
+        virtual void writeAt(uint64_t offset, const std::vector<unsigned char> &data);
+        virtual void resize(uint64_t size);
     };
 }
 
@@ -0,0 +1,120 @@
+//
+// Readers over bytes already in memory: caller's buffer or memory mapped file. Reading methods are final
+// and defined here, so the diff engine instantiated for these readers calls them directly and inlines
+// rollByte() into its byte loop. Used through io::FileReader & they still work as any other reader.
+
+#ifndef JDIFF_MEMORY_READER_HPP
+#define JDIFF_MEMORY_READER_HPP
+
+#include <algorithm>
+#include <cstring>
+#include "file_reader.hpp"
+
+namespace io {
+
+    class MemoryReader : public FileReader {
+    public:
+        // data has to outlive the reader, block size 0 is calculated from size
+        MemoryReader(const unsigned char *data, size_t size, uint32_t block_size = 0,
+                     Chunking chunking = Chunking::Fixed) {
+            reset(data, size, block_size, chunking);
+        }
+        explicit MemoryReader(const std::vector<unsigned char> &data, uint32_t block_size = 0,
+                              Chunking chunking = Chunking::Fixed)
+                : MemoryReader(data.data(), data.size(), block_size, chunking) {}
+
+        using FileReader::getNextChunk;
+        using FileReader::peek;
+        using FileReader::readAt;
+
+        bool rollByte() final {
+            if (position_ >= size_) {
+                return false;
+            }
+            pushFrameByte(static_cast<char>(data_[position_++]));
+            diff::count(stats_, diff::Stats::Counter::BytesRead);
+            return true;
+        }
+
+        void getNextChunk(std::vector<unsigned char> &chunk) final {
+            size_t length = size_ - position_;
+            if (chunking_ == Chunking::ContentDefined) {
+                diff::ScopedPhase hashing_phase(stats_, diff::Stats::Phase::Hashing);
+                length = FastCDC(max_frame_size_).cutPoint(data_ + position_, length);
+            } else {
+                length = std::min<size_t>(length, max_frame_size_);
+            }
+            chunk.assign(data_ + position_, data_ + position_ + length);
+            position_ += length;
+            diff::count(stats_, diff::Stats::Counter::BytesRead, length);
+        }
+
+        void peek(size_t length, std::vector<unsigned char> &data) final {
+            length = std::min(length, size_ - position_);
+            data.assign(data_ + position_, data_ + position_ + length);
+            diff::count(stats_, diff::Stats::Counter::BytesRead, length);
+        }
+
+        void skip(size_t length) final {
+            position_ += std::min(length, size_ - position_);
+            clearFrame();
+            rolled_out_ = 0;
+        }
+
+        void readAt(uint64_t offset, size_t length, std::vector<unsigned char> &data) final {
+            if (offset >= size_) {
+                data.clear();
+                return;
+            }
+            length = static_cast<size_t>(std::min<uint64_t>(length, size_ - offset));
+            data.assign(data_ + offset, data_ + offset + length);
+            diff::count(stats_, diff::Stats::Counter::BytesRead, length);
+        }
+
+        std::vector<uint8_t> getBuffer() final {
+            diff::count(stats_, diff::Stats::Counter::BytesRead, size_ - position_);
+            std::vector<uint8_t> buffer(data_ + position_, data_ + size_);
+            position_ = size_;
+            return buffer;
+        }
+
+        // whole input regardless of position, lets sha be computed without reading a file
+        const unsigned char * data() const { return data_; }
+        size_t size() const { return size_; }
+
+    protected:
+        MemoryReader() = default;
+
+        void reset(const unsigned char *data, size_t size, uint32_t block_size, Chunking chunking) {
+            data_ = data;
+            size_ = size;
+            position_ = 0;
+            max_frame_size_ = block_size > 0 ? block_size : calculateBlockSize(size);
+            chunking_ = chunking;
+            rolled_out_ = 0;
+            clearFrame();
+        }
+
+    private:
+        const unsigned char *data_ = nullptr;
+        size_t size_ = 0;
+        size_t position_ = 0;
+    };
+
+    // Whole file mapped read only, pages are loaded by the kernel as rolling reaches them
+    class MmapReader final : public MemoryReader {
+    public:
+        explicit MmapReader(const std::string &file_path, uint32_t block_size = 0,
+                            Chunking chunking = Chunking::Fixed);
+        ~MmapReader() override;
+
+        MmapReader(const MmapReader &) = delete;
+        MmapReader & operator=(const MmapReader &) = delete;
+
+    private:
+        void *mapping_ = nullptr;
+        size_t mapping_size_ = 0;
+    };
+}
+
+#endif //JDIFF_MEMORY_READER_HPP
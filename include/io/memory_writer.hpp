@@ -0,0 +1,39 @@
+//
+// Writer appending to caller's vector. Methods are final, so patch instantiated for it appends without
+// virtual calls.
+
+#ifndef JDIFF_MEMORY_WRITER_HPP
+#define JDIFF_MEMORY_WRITER_HPP
+
+#include "file_writer.hpp"
+
+namespace io {
+
+    class MemoryWriter final : public FileWriter {
+    public:
+        explicit MemoryWriter(std::vector<unsigned char> &buffer) : buffer_(buffer) {}
+
+        using FileWriter::append;
+
+        void append(const unsigned char *data, size_t size) final {
+            buffer_.insert(buffer_.end(), data, data + size);
+        }
+
+        // gaps are zero filled, there are no holes in memory
+        void writeAt(uint64_t offset, const std::vector<unsigned char> &data) final {
+            if (buffer_.size() < offset + data.size()) {
+                buffer_.resize(offset + data.size());
+            }
+            std::copy(data.begin(), data.end(), buffer_.begin() + static_cast<long>(offset));
+        }
+
+        void resize(uint64_t size) final {
+            buffer_.resize(size);
+        }
+
+    private:
+        std::vector<unsigned char> &buffer_;
+    };
+}
+
+#endif //JDIFF_MEMORY_WRITER_HPP
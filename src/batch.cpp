@@ -0,0 +1,335 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include "trace.hpp"
+
+namespace diff {
+    static constexpr size_t batchInputCount(BatchOp op) {
+        return op == BatchOp::Signature ? 1 : 2;
+    }
+
+    BatchOp batchOpFromString(const std::string &name) {
+        if (name == "signature") {
+            return BatchOp::Signature;
+        } else if (name == "delta") {
+            return BatchOp::Delta;
+        } else if (name == "patch") {
+            return BatchOp::Patch;
+        } else if (name == "diff") {
+            return BatchOp::Diff;
+        }
+        throw std::invalid_argument(std::string("Unknown batch operation " + name + "!"));
+    }
+
+    const char * batchOpName(BatchOp op) {
+        switch (op) {
+            case BatchOp::Signature:
+                return "signature";
+            case BatchOp::Delta:
+                return "delta";
+            case BatchOp::Patch:
+                return "patch";
+            case BatchOp::Diff:
+                return "diff";
+        }
+        return "unknown";
+    }
+
+    static std::string manifestPath(const std::string &path) {
+        return std::filesystem::path(path).lexically_normal().string();
+    }
+
+    // Items reading output of an earlier item run in a later stage, after it is written. Items of one stage are
+    // independent and run in parallel.
+    struct BatchPlan {
+        std::vector<size_t> stage;
+        // items writing inputs of each item
+        std::vector<std::vector<size_t>> producers;
+        size_t stages = 0;
+    };
+
+    static BatchPlan planBatch(const std::vector<BatchItem> &items) {
+        // output path -> item writing it, two writers of one file would race
+        std::unordered_map<std::string, size_t> outputs;
+        for (size_t i = 0; i < items.size(); i++) {
+            auto [written, inserted] = outputs.try_emplace(manifestPath(items[i].output), i);
+            if (!inserted) {
+                throw std::invalid_argument(std::string("Manifest line " + std::to_string(items[i].line) +
+                        " writes output " + items[i].output + " of line " +
+                        std::to_string(items[written->second].line) + "!"));
+            }
+        }
+
+        BatchPlan plan;
+        plan.stage.assign(items.size(), 0);
+        plan.producers.resize(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            for (const auto &input : items[i].inputs) {
+                auto producer = outputs.find(manifestPath(input));
+                if (producer == outputs.end()) {
+                    continue;
+                }
+                // lines run after the ones they read from, so a later line can't be read
+                if (producer->second >= i) {
+                    throw std::invalid_argument(std::string("Manifest line " + std::to_string(items[i].line) +
+                            " reads output " + input + " of line " +
+                            std::to_string(items[producer->second].line) + " that doesn't run before it!"));
+                }
+                plan.producers[i].push_back(producer->second);
+                plan.stage[i] = std::max(plan.stage[i], plan.stage[producer->second] + 1);
+            }
+            plan.stages = std::max(plan.stages, plan.stage[i] + 1);
+        }
+        return plan;
+    }
+
+    std::vector<BatchItem> parseManifest(std::istream &manifest) {
+        std::vector<BatchItem> items;
+        std::string line;
+        size_t line_number = 0;
+        while (std::getline(manifest, line)) {
+            line_number++;
+            std::istringstream fields(line);
+            std::vector<std::string> tokens;
+            std::string token;
+            while (fields >> std::quoted(token)) {
+                tokens.push_back(token);
+            }
+            // quoted empty token has no first character
+            if (tokens.empty() || (!tokens.front().empty() && tokens.front().front() == '#')) {
+                continue;
+            }
+
+            BatchItem item;
+            item.op = batchOpFromString(tokens.front());
+            item.line = line_number;
+            if (tokens.size() != batchInputCount(item.op) + 2) {
+                throw std::invalid_argument(std::string("Manifest line " + std::to_string(line_number) + " needs " +
+                        std::to_string(batchInputCount(item.op)) + " inputs and output!"));
+            }
+            item.inputs.assign(tokens.begin() + 1, tokens.end() - 1);
+            item.output = tokens.back();
+            items.push_back(std::move(item));
+        }
+        planBatch(items);
+        return items;
+    }
+
+    void IoBudget::acquire(uint64_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait(lock, [&] { return in_flight_ == 0 || in_flight_ + bytes <= limit_; });
+        in_flight_ += bytes;
+    }
+
+    void IoBudget::release(uint64_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_ -= bytes;
+        }
+        released_.notify_all();
+    }
+
+    WorkStealingPool::WorkStealingPool(unsigned threads) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        queues_.resize(threads);
+    }
+
+    bool WorkStealingPool::take(unsigned worker, size_t &task) {
+        for (unsigned i = 0; i < queues_.size(); i++) {
+            Queue &queue = queues_[(worker + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            // own queue from the front, victims from the back
+            if (i == 0) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            } else {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void WorkStealingPool::run(const std::vector<size_t> &order, const std::function<void(size_t)> &task) {
+        auto workers_count = static_cast<unsigned>(std::min<size_t>(queues_.size(), order.size()));
+        if (workers_count == 0) {
+            return;
+        }
+        for (size_t i = 0; i < order.size(); i++) {
+            queues_[i % workers_count].tasks.push_back(order[i]);
+        }
+
+        // no task adds new ones, so worker finding every queue empty is done
+        auto work = [&](unsigned worker) {
+            size_t next;
+            while (take(worker, next)) {
+                task(next);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < workers_count; t++) {
+            workers.emplace_back(work, t);
+        }
+        work(0);
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    static uint64_t fileSize(const std::string &file_path) {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(file_path, error);
+        return error ? 0 : size;
+    }
+
+    static uint64_t inputSize(const BatchItem &item) {
+        uint64_t size = 0;
+        for (const auto &input : item.inputs) {
+            size += fileSize(input);
+        }
+        return size;
+    }
+
+    // Output is created exclusively, so file appearing after the check can't be overwritten. Removed again when
+    // the item fails.
+    class ReservedOutput {
+    public:
+        explicit ReservedOutput(const std::string &file_path) : file_path_(file_path) {
+            int fd = open(file_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd < 0) {
+                if (errno == EEXIST) {
+                    throw std::invalid_argument(std::string("Output " + file_path + " already exists, use -f!"));
+                }
+                throw std::invalid_argument(std::string("Output " + file_path + " can't be created!"));
+            }
+            close(fd);
+        }
+        ~ReservedOutput() {
+            if (!done_) {
+                std::error_code error;
+                std::filesystem::remove(file_path_, error);
+            }
+        }
+        ReservedOutput(const ReservedOutput &) = delete;
+        ReservedOutput & operator=(const ReservedOutput &) = delete;
+
+        void done() { done_ = true; }
+
+    private:
+        std::string file_path_;
+        bool done_ = false;
+    };
+
+    // Same steps as the command line runs for the operation
+    static void runBatchItem(const BatchItem &item, const BatchOptions &options) {
+        JDIFF_TRACE_SCOPE("runBatchItem");
+        std::optional<ReservedOutput> reserved;
+        if (!options.force) {
+            reserved.emplace(item.output);
+        }
+
+        Diff d;
+        switch (item.op) {
+            case BatchOp::Signature: {
+                io::MmapReader reader(item.inputs[0], options.block_size, options.chunking);
+                d.prepareSignatures(reader, options.sha, options.rolling_hash);
+                d.generateSignatureFile(item.output);
+                break;
+            }
+            case BatchOp::Delta: {
+                d.getSignatureFromFile(item.inputs[0]);
+                io::MmapReader reader(item.inputs[1], d.signature().block_size, d.signature().chunking);
+                d.prepareDelta(d.signature(), reader, options.sha);
+                d.generateDeltaFile(item.output, options.compression);
+                break;
+            }
+            case BatchOp::Patch: {
+                io::FileReader dictionary_reader(item.inputs[0]);
+                d.getDeltaFromFile(item.inputs[1], &dictionary_reader);
+                io::FileReader reader(item.inputs[0], d.delta().block_size, d.delta().chunking);
+                io::FileWriter writer(item.output);
+                Diff::patchFile(d.delta(), reader, writer, options.sha);
+                break;
+            }
+            case BatchOp::Diff: {
+                io::FileReader base_reader(item.inputs[0]);
+                io::FileReader reader(item.inputs[1]);
+                // items are the parallelism, one index thread each
+                d.prepareDirectDelta(base_reader, reader, options.sha, 1);
+                d.generateDeltaFile(item.output, options.compression);
+                break;
+            }
+        }
+        if (reserved) {
+            reserved->done();
+        }
+    }
+
+    std::vector<BatchResult> runBatch(const std::vector<BatchItem> &items, const BatchOptions &options,
+                                      const BatchCallback &on_done) {
+        BatchPlan plan = planBatch(items);
+        std::vector<BatchResult> results(items.size());
+        std::vector<uint64_t> sizes(items.size());
+
+        IoBudget budget(options.io_budget);
+        std::mutex report_mutex;
+        WorkStealingPool pool(options.threads);
+        for (size_t stage = 0; stage < plan.stages; stage++) {
+            // inputs written by earlier stages exist only now
+            std::vector<size_t> order;
+            for (size_t i = 0; i < items.size(); i++) {
+                if (plan.stage[i] == stage) {
+                    sizes[i] = inputSize(items[i]);
+                    order.push_back(i);
+                }
+            }
+            // largest first, small items fill the gaps at the end
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+            pool.run(order, [&](size_t i) {
+                BatchResult &result = results[i];
+                result.bytes_read = sizes[i];
+                budget.acquire(sizes[i]);
+                auto start = std::chrono::steady_clock::now();
+                try {
+                    for (size_t producer : plan.producers[i]) {
+                        if (!results[producer].ok) {
+                            throw std::invalid_argument(std::string("Input " + items[producer].output +
+                                    " of line " + std::to_string(items[producer].line) + " failed!"));
+                        }
+                    }
+                    runBatchItem(items[i], options);
+                    result.ok = true;
+                    result.bytes_written = fileSize(items[i].output);
+                } catch (const std::exception &e) {
+                    result.error = e.what();
+                }
+                result.wall_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count());
+                budget.release(sizes[i]);
+
+                if (on_done) {
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    on_done(items[i], result);
+                }
+            });
+        }
+        return results;
+    }
+}
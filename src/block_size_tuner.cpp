@@ -0,0 +1,94 @@
+#include "block_size_tuner.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <set>
+
+namespace diff {
+    BlockSizeTuner::BlockSizeTuner(uintmax_t file_size) {
+        file_size_ = file_size;
+        changed_regions_rate_ = file_size > 0 ? s_default_changed_regions / static_cast<double>(file_size) : 0;
+        edit_bytes_per_region_ = 0;
+        sampled_ = false;
+    }
+
+    void BlockSizeTuner::sampleChanges(const Signature &signature, const Delta &delta) {
+        auto sample_size = static_cast<double>(signature.block_count) * signature.block_size;
+        if (sample_size <= 0) {
+            throw std::invalid_argument("Sample signature is empty!");
+        }
+        if (signature.block_size != delta.block_size) {
+            throw std::invalid_argument("Sample delta wasn't created from sample signature!");
+        }
+
+        std::set<uint64_t> changed_indexes;
+        uint64_t literal_bytes = 0;
+        for (const auto &[index, bytes] : delta.inserts) {
+            changed_indexes.insert(index);
+            literal_bytes += bytes.size();
+        }
+        for (const auto &[index, count] : delta.deletes) {
+            changed_indexes.insert(index);
+        }
+
+        // at least one region, unchanged sample still has to predict something above zero
+        auto regions = static_cast<double>(std::max<size_t>(changed_indexes.size(), 1));
+        changed_regions_rate_ = regions / sample_size;
+
+        // block granular delta re-sends about one whole block around every edit
+        double literal_per_region = static_cast<double>(literal_bytes) / regions;
+        edit_bytes_per_region_ = std::max(0.0, literal_per_region - signature.block_size);
+        sampled_ = true;
+    }
+
+    BlockSizeEstimate BlockSizeTuner::estimate(uint32_t block_size) const {
+        BlockSizeEstimate estimate;
+        estimate.block_size = block_size;
+        if (block_size == 0) {
+            return estimate;
+        }
+
+        uint64_t blocks = (file_size_ + block_size - 1) / block_size;
+        double regions = changed_regions_rate_ * static_cast<double>(file_size_);
+        double delta_bytes = regions * (edit_bytes_per_region_ + block_size + s_delta_entry_bytes);
+
+        estimate.signature_bytes = blocks * s_signature_entry_bytes;
+        estimate.delta_bytes = static_cast<uint64_t>(std::min(delta_bytes, static_cast<double>(file_size_)));
+        estimate.cpu_cost = blocks * s_cpu_block_cost;
+        return estimate;
+    }
+
+    BlockSizeEstimate BlockSizeTuner::tune() const {
+        BlockSizeEstimate best = estimate(sqrtBlockSize(file_size_));
+        if (!sampled_) {
+            return best;
+        }
+
+        for (uint32_t block_size = s_min_block_size; block_size <= s_max_block_size; block_size *= 2) {
+            // keep at least two blocks, same as the default heuristic
+            if (block_size > file_size_ / 2) {
+                break;
+            }
+            BlockSizeEstimate candidate = estimate(block_size);
+            if (candidate.total() < best.total()) {
+                best = candidate;
+            }
+        }
+
+        return best;
+    }
+
+    uint32_t BlockSizeTuner::sqrtBlockSize(uintmax_t file_size) {
+        auto root = static_cast<uint64_t>(std::sqrt(static_cast<double>(file_size)));
+        uint64_t block_size = std::clamp<uint64_t>(std::bit_ceil(std::max<uint64_t>(root, 1)),
+                                                   s_min_block_size, s_max_block_size);
+
+        // keep at least two blocks, same as the default heuristic
+        while (block_size > 1 && (file_size / 2) < block_size) {
+            block_size /= 2;
+        }
+
+        return static_cast<uint32_t>(block_size);
+    }
+}
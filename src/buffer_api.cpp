@@ -0,0 +1,75 @@
+#include "buffer_api.hpp"
+
+namespace diff {
+    static io::MemoryReader memoryReader(std::span<const std::byte> data, uint32_t block_size = 0,
+                                         io::Chunking chunking = io::Chunking::Fixed) {
+        return io::MemoryReader(reinterpret_cast<const unsigned char *>(data.data()), data.size(), block_size,
+                                chunking);
+    }
+
+    static std::vector<ubyte_t> toVector(std::span<const std::byte> data) {
+        auto begin = reinterpret_cast<const ubyte_t *>(data.data());
+        return std::vector<ubyte_t>(begin, begin + data.size());
+    }
+
+    Signature makeSignature(std::span<const std::byte> base, const SignatureOptions &options) {
+        io::MemoryReader reader = memoryReader(base, options.block_size, options.chunking);
+        Diff d;
+        d.prepareSignatures(reader, options.sha, options.rolling_hash);
+        return d.takeSignature();
+    }
+
+    Delta makeDelta(const Signature &signature, std::span<const std::byte> target, bool sha) {
+        io::MemoryReader reader = memoryReader(target, signature.block_size, signature.chunking);
+        Diff d;
+        d.prepareDelta(signature, reader, sha);
+        return d.takeDelta();
+    }
+
+    Delta makeDirectDelta(std::span<const std::byte> base, std::span<const std::byte> target, bool sha,
+                          unsigned threads) {
+        io::MemoryReader base_reader = memoryReader(base);
+        io::MemoryReader reader = memoryReader(target);
+        Diff d;
+        d.prepareDirectDelta(base_reader, reader, sha, threads);
+        return d.takeDelta();
+    }
+
+    void applyDelta(const Delta &delta, std::span<const std::byte> base, const ByteCallback &sink, bool check_sha) {
+        io::MemoryReader reader = memoryReader(base, delta.block_size, delta.chunking);
+        CallbackWriter writer(sink);
+        Diff::patchFile(delta, reader, writer, check_sha);
+    }
+
+    std::vector<std::byte> applyDelta(const Delta &delta, std::span<const std::byte> base, bool check_sha) {
+        std::vector<std::byte> output;
+        applyDelta(delta, base, [&output](std::span<const std::byte> data) {
+            output.insert(output.end(), data.begin(), data.end());
+        }, check_sha);
+        return output;
+    }
+
+    void serializeSignature(const Signature &signature, const ByteCallback &sink) {
+        std::vector<ubyte_t> buffer = signature.serialize();
+        sink(std::as_bytes(std::span<const ubyte_t>(buffer)));
+    }
+
+    Signature deserializeSignature(std::span<const std::byte> data) {
+        Signature signature;
+        signature.deserialize(toVector(data));
+        return signature;
+    }
+
+    void serializeDelta(const Delta &delta, const ByteCallback &sink, std::span<const std::byte> base) {
+        io::MemoryReader reader = memoryReader(base);
+        std::vector<ubyte_t> buffer = delta.serialize(base.empty() ? nullptr : &reader);
+        sink(std::as_bytes(std::span<const ubyte_t>(buffer)));
+    }
+
+    Delta deserializeDelta(std::span<const std::byte> data, std::span<const std::byte> base) {
+        io::MemoryReader reader = memoryReader(base);
+        Delta delta;
+        delta.deserialize(toVector(data), base.empty() ? nullptr : &reader);
+        return delta;
+    }
+}
@@ -0,0 +1,462 @@
+#include "compression.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <new>
+#include <stdexcept>
+
+#ifdef JDIFF_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef JDIFF_WITH_ZSTD
+// magicless frame format of dictionary literals is in the experimental part of the API
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+#endif
+
+namespace diff {
+    static constexpr size_t s_out_chunk_size = (1 << 16);
+
+#ifdef JDIFF_WITH_ZSTD
+    // zstd returns null context when it's out of memory
+    template<typename Context>
+    static Context * requireContext(Context *context) {
+        if (context == nullptr) {
+            throw std::bad_alloc();
+        }
+        return context;
+    }
+#endif
+
+    struct Compressor::Codec {
+        virtual ~Codec() = default;
+        virtual void write(const unsigned char *data, size_t size) = 0;
+        virtual void finish() = 0;
+    };
+
+    struct Decompressor::Codec {
+        virtual ~Codec() = default;
+        virtual void read(unsigned char *output, size_t size) = 0;
+        virtual void finish() = 0;
+    };
+
+    bool isCompressionAvailable(Compression compression) {
+        switch (compression) {
+            case Compression::None:
+                return true;
+            case Compression::Zlib:
+#ifdef JDIFF_WITH_ZLIB
+                return true;
+#else
+                return false;
+#endif
+            case Compression::Zstd:
+#ifdef JDIFF_WITH_ZSTD
+                return true;
+#else
+                return false;
+#endif
+        }
+        return false;
+    }
+
+    Compression defaultCompression() {
+        if (isCompressionAvailable(Compression::Zstd)) return Compression::Zstd;
+        if (isCompressionAvailable(Compression::Zlib)) return Compression::Zlib;
+        return Compression::None;
+    }
+
+    Compression compressionFromString(const std::string &name) {
+        if (name == "none") return Compression::None;
+        if (name == "zlib") return Compression::Zlib;
+        if (name == "zstd") return Compression::Zstd;
+        if (name == "auto") return defaultCompression();
+        throw std::invalid_argument(std::string("Unknown compression " + name + "!"));
+    }
+
+    std::string compressionName(Compression compression) {
+        switch (compression) {
+            case Compression::None:
+                return "none";
+            case Compression::Zlib:
+                return "zlib";
+            case Compression::Zstd:
+                return "zstd";
+        }
+        return "unknown";
+    }
+
+    static void requireCompression(Compression compression) {
+        if (!isCompressionAvailable(compression)) {
+            throw std::invalid_argument(std::string("Compression " + compressionName(compression) +
+                                                    " isn't supported by this build!"));
+        }
+    }
+
+#ifdef JDIFF_WITH_ZLIB
+    struct ZlibCompressor : Compressor::Codec {
+        explicit ZlibCompressor(std::vector<unsigned char> &output) : output_(output) {
+            if (deflateInit(&stream_, Z_BEST_COMPRESSION) != Z_OK) {
+                throw std::invalid_argument("Zlib initialization failed!");
+            }
+        }
+
+        ~ZlibCompressor() override {
+            deflateEnd(&stream_);
+        }
+
+        void write(const unsigned char *data, size_t size) override {
+            while (size > 0) {
+                auto piece = static_cast<uInt>(std::min<size_t>(size, UINT_MAX));
+                stream_.next_in = const_cast<Bytef *>(data);
+                stream_.avail_in = piece;
+                deflateAll(Z_NO_FLUSH);
+                data += piece;
+                size -= piece;
+            }
+        }
+
+        void finish() override {
+            stream_.next_in = nullptr;
+            stream_.avail_in = 0;
+            deflateAll(Z_FINISH);
+        }
+
+    private:
+        void deflateAll(int flush) {
+            int result;
+            do {
+                size_t used = output_.size();
+                output_.resize(used + s_out_chunk_size);
+                stream_.next_out = output_.data() + used;
+                stream_.avail_out = s_out_chunk_size;
+                result = deflate(&stream_, flush);
+                output_.resize(output_.size() - stream_.avail_out);
+                if (result == Z_STREAM_ERROR) {
+                    throw std::invalid_argument("Zlib compression failed!");
+                }
+            } while (stream_.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+        }
+
+        z_stream stream_{};
+        std::vector<unsigned char> &output_;
+    };
+
+    struct ZlibDecompressor : Decompressor::Codec {
+        ZlibDecompressor(const unsigned char *data, size_t size) : input_(data), remaining_(size) {
+            if (inflateInit(&stream_) != Z_OK) {
+                throw std::invalid_argument("Zlib initialization failed!");
+            }
+        }
+
+        ~ZlibDecompressor() override {
+            inflateEnd(&stream_);
+        }
+
+        void read(unsigned char *output, size_t size) override {
+            while (size > 0) {
+                if (stream_.avail_in == 0 && remaining_ > 0) {
+                    auto piece = static_cast<uInt>(std::min<size_t>(remaining_, UINT_MAX));
+                    stream_.next_in = const_cast<Bytef *>(input_);
+                    stream_.avail_in = piece;
+                    input_ += piece;
+                    remaining_ -= piece;
+                }
+
+                auto piece = static_cast<uInt>(std::min<size_t>(size, UINT_MAX));
+                stream_.next_out = output;
+                stream_.avail_out = piece;
+                int result = inflate(&stream_, Z_NO_FLUSH);
+                size_t produced = piece - stream_.avail_out;
+                output += produced;
+                size -= produced;
+
+                if (result == Z_STREAM_END && size > 0) {
+                    throw std::invalid_argument("Compressed literals are truncated!");
+                }
+                if (result != Z_OK && result != Z_STREAM_END && !(result == Z_BUF_ERROR && produced > 0)) {
+                    throw std::invalid_argument("Compressed literals are corrupted!");
+                }
+            }
+        }
+
+        void finish() override {
+            // frame with more data than declared fills the spare byte
+            unsigned char spare;
+            while (true) {
+                if (stream_.avail_in == 0 && remaining_ > 0) {
+                    auto piece = static_cast<uInt>(std::min<size_t>(remaining_, UINT_MAX));
+                    stream_.next_in = const_cast<Bytef *>(input_);
+                    stream_.avail_in = piece;
+                    input_ += piece;
+                    remaining_ -= piece;
+                }
+                stream_.next_out = &spare;
+                stream_.avail_out = 1;
+                int result = inflate(&stream_, Z_NO_FLUSH);
+                if (stream_.avail_out == 0) {
+                    throw std::invalid_argument("Compressed literals are longer than declared!");
+                }
+                if (result == Z_STREAM_END) {
+                    return;
+                }
+                if (result == Z_BUF_ERROR) {
+                    throw std::invalid_argument("Compressed literals are truncated!");
+                }
+                if (result != Z_OK) {
+                    throw std::invalid_argument("Compressed literals are corrupted!");
+                }
+            }
+        }
+
+    private:
+        z_stream stream_{};
+        const unsigned char *input_;
+        size_t remaining_;
+    };
+#endif
+
+#ifdef JDIFF_WITH_ZSTD
+    struct ZstdCompressor : Compressor::Codec {
+        explicit ZstdCompressor(std::vector<unsigned char> &output) : output_(output) {
+            stream_ = requireContext(ZSTD_createCCtx());
+            ZSTD_CCtx_setParameter(stream_, ZSTD_c_compressionLevel, 19);
+        }
+
+        ~ZstdCompressor() override {
+            ZSTD_freeCCtx(stream_);
+        }
+
+        void write(const unsigned char *data, size_t size) override {
+            ZSTD_inBuffer input{data, size, 0};
+            while (input.pos < input.size) {
+                compress(input, ZSTD_e_continue);
+            }
+        }
+
+        void finish() override {
+            ZSTD_inBuffer input{nullptr, 0, 0};
+            while (compress(input, ZSTD_e_end) != 0) {}
+        }
+
+    private:
+        size_t compress(ZSTD_inBuffer &input, ZSTD_EndDirective directive) {
+            size_t used = output_.size();
+            output_.resize(used + s_out_chunk_size);
+            ZSTD_outBuffer output{output_.data() + used, s_out_chunk_size, 0};
+            size_t result = ZSTD_compressStream2(stream_, &output, &input, directive);
+            output_.resize(used + output.pos);
+            if (ZSTD_isError(result)) {
+                throw std::invalid_argument("Zstd compression failed!");
+            }
+            return result;
+        }
+
+        ZSTD_CCtx *stream_;
+        std::vector<unsigned char> &output_;
+    };
+
+    struct ZstdDecompressor : Decompressor::Codec {
+        ZstdDecompressor(const unsigned char *data, size_t size) : input_{data, size, 0} {
+            stream_ = requireContext(ZSTD_createDCtx());
+        }
+
+        ~ZstdDecompressor() override {
+            ZSTD_freeDCtx(stream_);
+        }
+
+        void read(unsigned char *output, size_t size) override {
+            ZSTD_outBuffer out{output, size, 0};
+            while (out.pos < out.size) {
+                size_t input_pos = input_.pos;
+                size_t output_pos = out.pos;
+                size_t result = ZSTD_decompressStream(stream_, &out, &input_);
+                if (ZSTD_isError(result)) {
+                    throw std::invalid_argument("Compressed literals are corrupted!");
+                }
+                if (input_.pos == input_pos && out.pos == output_pos) {
+                    throw std::invalid_argument("Compressed literals are truncated!");
+                }
+                frame_done_ = result == 0;
+            }
+        }
+
+        void finish() override {
+            // frame with more data than declared fills the spare byte
+            unsigned char spare;
+            while (!frame_done_) {
+                ZSTD_outBuffer out{&spare, 1, 0};
+                size_t input_pos = input_.pos;
+                size_t result = ZSTD_decompressStream(stream_, &out, &input_);
+                if (ZSTD_isError(result)) {
+                    throw std::invalid_argument("Compressed literals are corrupted!");
+                }
+                if (out.pos > 0) {
+                    throw std::invalid_argument("Compressed literals are longer than declared!");
+                }
+                if (result != 0 && input_.pos == input_pos) {
+                    throw std::invalid_argument("Compressed literals are truncated!");
+                }
+                frame_done_ = result == 0;
+            }
+        }
+
+    private:
+        ZSTD_DCtx *stream_;
+        ZSTD_inBuffer input_;
+        // last call flushed the whole frame
+        bool frame_done_ = false;
+    };
+#endif
+
+    std::vector<unsigned char> compressWithDictionary(Compression compression, const unsigned char *data, size_t size,
+                                                      const std::vector<unsigned char> &dictionary) {
+        requireCompression(compression);
+        std::vector<unsigned char> frame;
+#ifdef JDIFF_WITH_ZLIB
+        if (compression == Compression::Zlib) {
+            z_stream stream{};
+            // zlib header keeps dictionary id and checksum, so a different base file is detected
+            if (deflateInit(&stream, Z_BEST_COMPRESSION) != Z_OK) {
+                throw std::invalid_argument("Zlib initialization failed!");
+            }
+            if (!dictionary.empty()) {
+                deflateSetDictionary(&stream, dictionary.data(), static_cast<uInt>(dictionary.size()));
+            }
+            frame.resize(deflateBound(&stream, static_cast<uLong>(size)));
+            stream.next_in = const_cast<Bytef *>(data);
+            stream.avail_in = static_cast<uInt>(size);
+            stream.next_out = frame.data();
+            stream.avail_out = static_cast<uInt>(frame.size());
+            int result = deflate(&stream, Z_FINISH);
+            frame.resize(stream.total_out);
+            deflateEnd(&stream);
+            if (result != Z_STREAM_END) {
+                throw std::invalid_argument("Zlib compression failed!");
+            }
+        }
+#endif
+#ifdef JDIFF_WITH_ZSTD
+        if (compression == Compression::Zstd) {
+            ZSTD_CCtx *context = requireContext(ZSTD_createCCtx());
+            ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, 19);
+            ZSTD_CCtx_setParameter(context, ZSTD_c_contentSizeFlag, 0);
+            ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1);
+            ZSTD_CCtx_setParameter(context, ZSTD_c_format, ZSTD_f_zstd1_magicless);
+            ZSTD_CCtx_refPrefix(context, dictionary.data(), dictionary.size());
+            frame.resize(ZSTD_compressBound(size));
+            size_t result = ZSTD_compress2(context, frame.data(), frame.size(), data, size);
+            ZSTD_freeCCtx(context);
+            if (ZSTD_isError(result)) {
+                throw std::invalid_argument("Zstd compression failed!");
+            }
+            frame.resize(result);
+        }
+#endif
+        if (frame.size() >= size) {
+            frame.clear();
+        }
+        return frame;
+    }
+
+    void decompressWithDictionary(Compression compression, const unsigned char *frame, size_t frame_size,
+                                  unsigned char *output, size_t size, const std::vector<unsigned char> &dictionary) {
+        requireCompression(compression);
+        bool complete = false;
+#ifdef JDIFF_WITH_ZLIB
+        if (compression == Compression::Zlib) {
+            z_stream stream{};
+            if (inflateInit(&stream) != Z_OK) {
+                throw std::invalid_argument("Zlib initialization failed!");
+            }
+            stream.next_in = const_cast<Bytef *>(frame);
+            stream.avail_in = static_cast<uInt>(frame_size);
+            stream.next_out = output;
+            stream.avail_out = static_cast<uInt>(size);
+            int result = inflate(&stream, Z_FINISH);
+            if (result == Z_NEED_DICT &&
+                inflateSetDictionary(&stream, dictionary.data(), static_cast<uInt>(dictionary.size())) == Z_OK) {
+                result = inflate(&stream, Z_FINISH);
+            }
+            complete = result == Z_STREAM_END && stream.avail_out == 0;
+            inflateEnd(&stream);
+        }
+#endif
+#ifdef JDIFF_WITH_ZSTD
+        if (compression == Compression::Zstd) {
+            ZSTD_DCtx *context = requireContext(ZSTD_createDCtx());
+            ZSTD_DCtx_setParameter(context, ZSTD_d_format, ZSTD_f_zstd1_magicless);
+            ZSTD_DCtx_refPrefix(context, dictionary.data(), dictionary.size());
+            size_t result = ZSTD_decompressDCtx(context, output, size, frame, frame_size);
+            ZSTD_freeDCtx(context);
+            complete = !ZSTD_isError(result) && result == size;
+        }
+#endif
+        if (!complete) {
+            throw std::invalid_argument("Compressed literals are corrupted or base file differs!");
+        }
+    }
+
+    Compressor::Compressor(Compression compression, std::vector<unsigned char> &output) {
+        requireCompression(compression);
+#ifdef JDIFF_WITH_ZLIB
+        if (compression == Compression::Zlib) codec_ = std::make_unique<ZlibCompressor>(output);
+#endif
+#ifdef JDIFF_WITH_ZSTD
+        if (compression == Compression::Zstd) codec_ = std::make_unique<ZstdCompressor>(output);
+#endif
+        if (!codec_) {
+            throw std::invalid_argument("Literals can't be compressed with none!");
+        }
+    }
+
+    Compressor::~Compressor() = default;
+
+    void Compressor::write(const unsigned char *data, size_t size) {
+        codec_->write(data, size);
+    }
+
+    void Compressor::finish() {
+        codec_->finish();
+    }
+
+    Decompressor::Decompressor(Compression compression, const unsigned char *data, size_t size) {
+        requireCompression(compression);
+#ifdef JDIFF_WITH_ZLIB
+        if (compression == Compression::Zlib) codec_ = std::make_unique<ZlibDecompressor>(data, size);
+#endif
+#ifdef JDIFF_WITH_ZSTD
+        if (compression == Compression::Zstd) codec_ = std::make_unique<ZstdDecompressor>(data, size);
+#endif
+        if (!codec_) {
+            throw std::invalid_argument("Literals can't be decompressed with none!");
+        }
+    }
+
+    Decompressor::~Decompressor() = default;
+
+    void Decompressor::read(unsigned char *output, size_t size) {
+        codec_->read(output, size);
+    }
+
+    void Decompressor::finish() {
+        codec_->finish();
+    }
+
+    uint64_t maxDecompressedSize(Compression compression, uint64_t compressed_size) {
+        // deflate tops at 1032:1, zstd at one RLE block of 128 KiB per 4 bytes
+        uint64_t ratio = 1;
+        switch (compression) {
+            case Compression::None:
+                ratio = 1;
+                break;
+            case Compression::Zlib:
+                ratio = 1032;
+                break;
+            case Compression::Zstd:
+                ratio = (1 << 15);
+                break;
+        }
+        return compressed_size > UINT64_MAX / ratio ? UINT64_MAX : compressed_size * ratio;
+    }
+}
@@ -1,138 +1,472 @@
 #include "diff.hpp"
+
+#include <openssl/evp.h>
+#include "match_index.hpp"
+#include "trace.hpp"
 #include "xxhash64.h"
 
 namespace diff {
-    void Diff::prepareSignatures(io::FileReader &reader, bool sha) {
-        signature_.clear();
-        signature_.block_size =  reader.max_frame_size();
+    static void readHeader(std::vector<ubyte_t> &buff, size_t &offset, uint32_t magic, uint16_t version,
+                           const std::string &name) {
+        uint32_t file_magic = 0;
+        uint16_t file_version = 0;
+        generic_read_var_offset(buff, offset, file_magic);
+        offset += sizeof(file_magic);
+        if(file_magic != magic){
+            throw std::invalid_argument(std::string("Not a " + name + " file!"));
+        }
+
+        generic_read_var_offset(buff, offset, file_version);
+        offset += sizeof(file_version);
+        if(file_version != version){
+            throw std::invalid_argument(std::string("Unsupported " + name + " version " +
+                                                    std::to_string(file_version) + "!"));
+        }
+    }
 
-        if(sha){
-            signature_.sha = calculateFileSha256(reader.file_path());
+    // Length read from the buffer, count items of item_size have to fit in its remaining bytes
+    static void requireRemaining(const std::vector<ubyte_t> &buff, size_t offset, uint64_t count,
+                                 size_t item_size = 1) {
+        if(offset > buff.size() || count > (buff.size() - offset) / item_size) {
+            throw std::invalid_argument("Buffer is truncated!");
         }
+    }
 
-        uint32_t index = 0;
+    // Literal bytes declared in the buffer. Stored ones have to fit in its remaining bytes, compressed ones in what
+    // the codec can inflate the remaining bytes to, counted together over declared.
+    static void requireLiterals(const std::vector<ubyte_t> &buff, size_t offset, uint64_t size,
+                                Compression compression, uint64_t &declared) {
+        if(compression == Compression::None) {
+            requireRemaining(buff, offset, size);
+            return;
+        }
+        uint64_t limit = maxDecompressedSize(compression, buff.size() - offset);
+        if(declared > limit || size > limit - declared) {
+            throw std::invalid_argument("Compressed literals are larger than their payload!");
+        }
+        declared += size;
+    }
+
+    static io::Chunking readChunking(std::vector<ubyte_t> &buff, size_t &offset) {
+        uint8_t chunking = 0;
+        generic_read_var_offset(buff, offset, chunking);
+        offset += sizeof(chunking);
+        if(chunking > static_cast<uint8_t>(io::Chunking::ContentDefined)){
+            throw std::invalid_argument("Unknown chunking mode!");
+        }
+        return static_cast<io::Chunking>(chunking);
+    }
 
-        std::vector<ubyte_t> data_chunk = reader.getNextChunk();
+    // Base bytes around the place literal run lands, mostly after it - edited data usually replaces what follows
+    static std::vector<ubyte_t> readDictionary(io::FileReader &r_base_file, uint64_t anchor) {
+        uint64_t begin = anchor > Delta::s_dictionary_size / 4 ? anchor - Delta::s_dictionary_size / 4 : 0;
+        return r_base_file.readAt(begin, Delta::s_dictionary_size);
+    }
 
-        while (!data_chunk.empty()){
-            uint32_t rolling_checksum = RHash::hashBuffer(data_chunk);
-            uint64_t xx_checksum = XXHash64::hash(data_chunk.data(), data_chunk.size(),0);
+    // Literal runs in serialization order - inserts by index, then literal instructions. Short runs come
+    // from the shared frame, long ones from their own frames compressed with base dictionary.
+    static void readDictionaryLiterals(Delta &delta, std::vector<ubyte_t> &buff, size_t offset, size_t end,
+                                       io::FileReader &r_base_file) {
+        size_t shared_size = 0;
+        if(offset + sizeof(shared_size) > end) {
+            throw std::invalid_argument("Compressed literals are truncated!");
+        }
+        generic_read_var_offset(buff, offset, shared_size);
+        offset += sizeof(shared_size);
+        if(shared_size > end - offset) {
+            throw std::invalid_argument("Compressed literals are truncated!");
+        }
+        Decompressor decompressor(delta.compression, buff.data() + offset, shared_size);
+        offset += shared_size;
 
-            signature_.addSignature(rolling_checksum, xx_checksum, index++);
+        auto pull_piece = [&](ubyte_t *data, size_t size, uint64_t anchor) {
+            size_t frame_size = 0;
+            if(offset + sizeof(frame_size) > end) {
+                throw std::invalid_argument("Compressed literals are truncated!");
+            }
+            generic_read_var_offset(buff, offset, frame_size);
+            offset += sizeof(frame_size);
+            size_t stored_size = frame_size == 0 ? size : frame_size;
+            if(stored_size > end - offset) {
+                throw std::invalid_argument("Compressed literals are truncated!");
+            }
+            if(frame_size == 0) {
+                std::copy(buff.begin()+offset, buff.begin()+offset+size, data);
+            } else {
+                decompressWithDictionary(delta.compression, buff.data() + offset, frame_size, data, size,
+                                         readDictionary(r_base_file, anchor));
+            }
+            offset += stored_size;
+        };
+        auto pull_literal = [&](ubyte_t *data, size_t size, uint64_t anchor) {
+            if(size < Delta::s_dictionary_min_run) {
+                decompressor.read(data, size);
+                return;
+            }
+            for(size_t piece = 0; piece < size; piece += Delta::s_dictionary_piece) {
+                pull_piece(data + piece, std::min(Delta::s_dictionary_piece, size - piece), anchor + piece);
+            }
+        };
 
-            data_chunk = reader.getNextChunk();
+        for(auto &[index, bytes] : delta.inserts) {
+            pull_literal(bytes.data(), bytes.size(), index * delta.block_size);
+        }
+        uint64_t anchor = 0;
+        for(const auto &instruction : delta.instructions) {
+            if(instruction.type == Instruction::Type::Copy) {
+                anchor = instruction.offset + instruction.length;
+            } else {
+                pull_literal(delta.literals.data() + instruction.offset, instruction.length, anchor);
+            }
         }
+        decompressor.finish();
     }
 
-    void Diff::prepareDelta(const Signature &signature, io::FileReader &reader, bool sha) {
-        delta_.clear();
-        delta_.block_size = signature.block_size;
-        if(sha) {
-            delta_.sha = signature.sha;
+    void Diff::countDelta(uint64_t block_count) {
+        if(!stats_) {
+            return;
         }
 
-        RHash rhash(delta_.block_size);
-        int last_found_index = -1;
-        std::vector<ubyte_t> inserts;
+        uint64_t literal_bytes = delta_.literals.size();
+        for(const auto &[index, bytes] : delta_.inserts) {
+            literal_bytes += bytes.size();
+        }
+        stats_->add(Stats::Counter::LiteralBytes, literal_bytes);
 
-        while(reader.rollByte()){
-            rhash.roll(reader.getRolledOutByte(), reader.getLatestByte());
-            inserts.push_back(reader.getLatestByte());
-            auto rolling_checksum = rhash.hash();
+        if(delta_.format == DeltaFormat::Instructions) {
+            for(const auto &instruction : delta_.instructions) {
+                if(instruction.type == Instruction::Type::Copy) {
+                    stats_->add(Stats::Counter::CopiedBytes, instruction.length);
+                }
+            }
+            return;
+        }
 
-            if(signature.signatures.contains(rolling_checksum)){
+        uint64_t deleted_blocks = 0;
+        for(const auto &[index, blocks] : delta_.deletes) {
+            deleted_blocks += blocks;
+        }
+        stats_->add(Stats::Counter::CopiedBlocks, block_count > deleted_blocks ? block_count - deleted_blocks : 0);
+    }
 
-                std::vector<ubyte_t> frame = reader.getCurrentFrame();
-                auto xx_checksum = XXHash64::hash(frame.data(), frame.size(),0);
-                if(signature.signatures.find(rolling_checksum)->second.contains(xx_checksum)){
-                    auto current_index =
-                            signature.signatures.find(rolling_checksum)->second.find(xx_checksum)->second;
-                    if(current_index > (last_found_index+1)){
-                        delta_.deletes[last_found_index+1] = current_index-(last_found_index+1);
-                    }
+    void Diff::matchTailBlock(const Signature &signature, std::vector<ubyte_t> &inserts, int64_t &last_found_index) {
+        uint64_t tail_size = signature.tailSize();
+        auto tail_index = static_cast<int64_t>(signature.block_count) - 1;
+        if(tail_size == 0 || tail_index <= last_found_index || inserts.size() < tail_size) {
+            return;
+        }
 
-                    for(int i = 0; i < delta_.block_size; i++) {
-                        inserts.pop_back();
-                    }
+        // rolling only hashes full windows, so short base tail is checked against the end of input here
+        const ubyte_t *tail = inserts.data() + inserts.size() - tail_size;
+        if(XXHash64::hash(tail, tail_size, 0) != signature.block_hashes[tail_index]) {
+            return;
+        }
 
-                    if(!inserts.empty()) {
-                        delta_.inserts[last_found_index+1] = inserts;
-                        inserts.clear();
-                    }
-                    last_found_index = static_cast<int>(current_index);
+        if(tail_index > (last_found_index+1)){
+            delta_.deletes[last_found_index+1] = tail_index-(last_found_index+1);
+        }
+
+        inserts.resize(inserts.size() - tail_size);
+        if(!inserts.empty()) {
+            delta_.inserts[last_found_index+1].assign(inserts.begin(), inserts.end());
+            inserts.clear();
+        }
+        last_found_index = tail_index;
+    }
+
+    void Diff::composeDeltas(const std::vector<Delta> &deltas, uint64_t base_size) {
+        JDIFF_TRACE_SCOPE("composeDeltas");
+        if(deltas.empty()) {
+            throw std::invalid_argument("No deltas to compose!");
+        }
+
+        delta_ = toInstructions(deltas.front(), base_size);
+        for(size_t i = 1; i < deltas.size(); i++) {
+            delta_ = composePair(delta_, toInstructions(deltas[i], outputSize(delta_)));
+        }
+    }
+
+    Delta Diff::toInstructions(const Delta &delta, uint64_t base_size) {
+        if(delta.format == DeltaFormat::Instructions) {
+            return delta;
+        }
+        if(delta.chunking != io::Chunking::Fixed) {
+            throw std::invalid_argument("Content defined chunking delta can't be converted to instructions!");
+        }
+        if(delta.block_size == 0) {
+            throw std::invalid_argument("Delta block size is zero!");
+        }
 
-                    continue;
+        Delta result;
+        result.sha = delta.sha;
+        result.format = DeltaFormat::Instructions;
+
+        // same walk as patchFile, block positions follow from block size and base size
+        uint64_t block_size = delta.block_size;
+        uint64_t block_count = (base_size + block_size - 1) / block_size;
+        auto chunk_size = [&](uint64_t index) {
+            return index < block_count ? std::min(block_size, base_size - index * block_size) : 0;
+        };
+
+        uint64_t index = 0;
+        while(index < block_count) {
+            uint64_t chunks_to_jump = 1;
+            auto deleted = delta.deletes.find(index);
+            auto extension = deleted != delta.deletes.end() ? delta.extensions.find(index) : delta.extensions.end();
+
+            if(extension != delta.extensions.end()) {
+                result.addCopy(index * block_size, std::min(extension->second.head, chunk_size(index)));
+            }
+
+            auto inserted = delta.inserts.find(index);
+            if(inserted != delta.inserts.end()) {
+                result.addLiteral(inserted->second.data(), inserted->second.size());
+            }
+
+            if(deleted != delta.deletes.end()) {
+                chunks_to_jump = deleted->second;
+                if(chunks_to_jump == 0) {
+                    throw std::invalid_argument("Delta deletes zero blocks!");
                 }
+            } else {
+                result.addCopy(index * block_size, chunk_size(index));
             }
+
+            uint64_t last = index + chunks_to_jump - 1;
+            if(extension != delta.extensions.end()) {
+                uint64_t tail = std::min(extension->second.tail, chunk_size(last));
+                result.addCopy(last * block_size + chunk_size(last) - tail, tail);
+            }
+            index += chunks_to_jump;
+        }
+
+        auto inserted = delta.inserts.find(index);
+        if(inserted != delta.inserts.end()) {
+            result.addLiteral(inserted->second.data(), inserted->second.size());
         }
+        return result;
+    }
+
+    Delta Diff::composePair(const Delta &older, const Delta &newer) {
+        // output offset where each instruction of older delta starts
+        std::vector<uint64_t> starts;
+        starts.reserve(older.instructions.size());
+        uint64_t older_size = 0;
+        for(const auto &instruction : older.instructions) {
+            starts.push_back(older_size);
+            older_size += instruction.length;
+        }
+
+        Delta result;
+        result.sha = older.sha;
+        result.format = DeltaFormat::Instructions;
+
+        for(const auto &instruction : newer.instructions) {
+            if(instruction.type == Instruction::Type::Literal) {
+                result.addLiteral(newer.literals.data() + instruction.offset, instruction.length);
+                continue;
+            }
+            if(instruction.offset + instruction.length > older_size) {
+                throw std::invalid_argument("Deltas don't form a chain, copy past previous result!");
+            }
 
-        if((last_found_index+1) < signature.signatures.size()) {
-            delta_.deletes[last_found_index+1] = signature.signatures.size()-(last_found_index+1);
+            uint64_t position = instruction.offset;
+            uint64_t end = instruction.offset + instruction.length;
+            auto i = static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), position) - starts.begin() - 1);
+            for(; position < end; i++) {
+                const Instruction &source = older.instructions[i];
+                uint64_t skip = position - starts[i];
+                uint64_t length = std::min(source.length - skip, end - position);
+                if(source.type == Instruction::Type::Copy) {
+                    result.addCopy(source.offset + skip, length);
+                } else {
+                    result.addLiteral(older.literals.data() + source.offset + skip, length);
+                }
+                position += length;
+            }
         }
+        return result;
+    }
 
-        if(!inserts.empty()){
-            delta_.inserts[last_found_index + 1] = inserts;
+    uint64_t Diff::outputSize(const Delta &delta) {
+        uint64_t size = 0;
+        for(const auto &instruction : delta.instructions) {
+            size += instruction.length;
         }
+        return size;
     }
 
-    void Diff::patchFile(const Delta &delta, io::FileReader &r_base_file,
-                         io::FileWriter &w_new_file, bool check_sha, const sha256_t& checksum) {
-        uint32_t index = 0;
-        uint16_t chunks_to_jump;
-        sha256_t sha_checksum;
+    void Diff::reverseDeletedChunk(Delta &reverse, const std::vector<ubyte_t> &chunk, uint64_t head, uint64_t head_offset,
+                                   uint64_t tail, uint64_t tail_offset) {
+        // head and tail of extended match are in the output, the rest of deleted chunk goes to reverse literals
+        uint64_t tail_begin = std::max<uint64_t>(head, chunk.size() - tail);
+        reverse.addCopy(head_offset, head);
+        reverse.addLiteral(chunk.data() + head, tail_begin - head);
+        reverse.addCopy(tail_offset + (tail_begin - (chunk.size() - tail)), chunk.size() - tail_begin);
+    }
 
-        if(check_sha && checksum.empty()){
-            sha_checksum = calculateFileSha256(r_base_file.file_path());
-        } else {
-            sha_checksum = checksum;
+    void Diff::extendMatches(io::FileReader &r_base_file) {
+        JDIFF_TRACE_SCOPE("extendMatches");
+        if(delta_.format != DeltaFormat::Blocks || delta_.chunking != io::Chunking::Fixed) {
+            return;
+        }
+        SharedStats shared_stats(stats_, r_base_file);
+        uint64_t extended_bytes = 0;
+
+        std::vector<ubyte_t> first;
+        std::vector<ubyte_t> last;
+        for(const auto &[index, count] : delta_.deletes) {
+            auto insert = delta_.inserts.find(index);
+            if(insert == delta_.inserts.end()) {
+                continue;
+            }
+
+            std::pmr::vector<ubyte_t> &literal = insert->second;
+            r_base_file.readAt(index * delta_.block_size, delta_.block_size, first);
+            r_base_file.readAt((index + count - 1) * delta_.block_size, delta_.block_size, last);
+
+            // bytes after previous match still equal to start of first deleted block
+            auto head = static_cast<uint64_t>(std::mismatch(literal.begin(), literal.end(),
+                                                            first.begin(), first.end()).first - literal.begin());
+            // bytes before next match still equal to end of last deleted block
+            auto tail = static_cast<uint64_t>(std::mismatch(literal.rbegin(), literal.rend() - static_cast<long>(head),
+                                                            last.rbegin(), last.rend()).first - literal.rbegin());
+            if(head == 0 && tail == 0) {
+                continue;
+            }
+
+            delta_.extensions[index] = {head, tail};
+            extended_bytes += head + tail;
+            literal.erase(literal.end() - static_cast<long>(tail), literal.end());
+            literal.erase(literal.begin(), literal.begin() + static_cast<long>(head));
+            if(literal.empty()) {
+                delta_.inserts.erase(insert);
+            }
         }
 
-        if(check_sha && !compareSha(delta.sha, sha_checksum)) {
-            throw std::invalid_argument("Delta hash doesn't match to the base file!");
+        // prepareDelta counted these bytes as literals, now they are copied from base
+        if(stats_) {
+            stats_->remove(Stats::Counter::LiteralBytes, extended_bytes);
+            stats_->add(Stats::Counter::CopiedBytes, extended_bytes);
         }
+    }
 
-        std::vector<ubyte_t> data_chunk = r_base_file.getNextChunk();
+    void Diff::prepareDirectDelta(io::FileReader &r_base_file, io::FileReader &reader, bool sha, unsigned threads) {
+        JDIFF_TRACE_SCOPE("prepareDirectDelta");
+        SharedStats base_stats(stats_, r_base_file);
+        SharedStats target_stats(stats_, reader);
+        delta_.clear();
+        delta_.format = DeltaFormat::Instructions;
+        if(sha) {
+            delta_.sha = readerSha256(r_base_file);
+        }
 
-        while(!data_chunk.empty()){
-            chunks_to_jump = 1;
-            if(delta.inserts.contains(index)){
-                w_new_file.append(delta.inserts.find(index)->second);
+        std::vector<ubyte_t> base = r_base_file.getBuffer();
+        std::vector<ubyte_t> target = reader.getBuffer();
+        std::unique_ptr<MatchIndex> index;
+        {
+            ScopedPhase hashing_phase(stats_, Stats::Phase::Hashing);
+            index = std::make_unique<MatchIndex>(base, threads);
+        }
+        SampledPhases phases(stats_);
+
+        constexpr uint32_t seed_size = MatchIndex::s_seed_size;
+        RabinKarpHash rhash(seed_size);
+        uint64_t literal_start = 0;
+        uint64_t position = 0;
+        bool rolled = false;
+
+        while(position + seed_size <= target.size()) {
+            if(!rolled) {
+                rhash = RabinKarpHash(seed_size);
+                for(uint64_t i = position; i < position + seed_size; i++) {
+                    rhash.roll(0, static_cast<char>(target[i]));
+                }
+                rolled = true;
             }
 
-            if(delta.deletes.contains(index)) {
-                chunks_to_jump = delta.deletes.find(index)->second;
-            } else {
-                w_new_file.append(data_chunk);
+            phases.next();
+            MatchIndex::Match match = index->find(target, position, rhash.hash(), literal_start);
+            phases.mark(Stats::Phase::Lookup);
+            count(stats_, Stats::Counter::RollingPositions);
+            // copy splits the literal run, shorter match costs more as copy and second literal record than as
+            // literal bytes
+            if(match.length > 2 * Instruction::s_encoded_size) {
+                count(stats_, Stats::Counter::StrongHits);
+                delta_.addLiteral(target.data() + literal_start, match.target_offset - literal_start);
+                delta_.addCopy(match.base_offset, match.length);
+                position = literal_start = match.target_offset + match.length;
+                rolled = false;
+                continue;
             }
 
-            for(auto i = 0; i < chunks_to_jump; i++, index++){
-                data_chunk = r_base_file.getNextChunk();
+            if(position + seed_size < target.size()) {
+                rhash.roll(static_cast<char>(target[position]), static_cast<char>(target[position + seed_size]));
             }
+            phases.mark(Stats::Phase::Hashing);
+            position++;
         }
+        delta_.addLiteral(target.data() + literal_start, target.size() - literal_start);
+        countDelta(0);
+    }
+
+    template void Diff::prepareSignatures<io::FileReader>(io::FileReader &, bool, RollingHashType, uint32_t);
+    template void Diff::prepareDelta<io::FileReader>(const Signature &, io::FileReader &, bool);
+    template void Diff::patchFile<io::FileReader, io::FileWriter>(const Delta &, io::FileReader &, io::FileWriter &,
+                                                                  bool, const sha256_t &, Delta *);
 
-        if(delta.inserts.contains(index)){
-            w_new_file.append(delta.inserts.find(index)->second);
+    struct Sha256::Context {
+        EVP_MD_CTX *ctx;
+
+        Context() : ctx(EVP_MD_CTX_new()) {
+            if(!ctx) {
+                throw std::bad_alloc();
+            }
+        }
+        ~Context() { EVP_MD_CTX_free(ctx); }
+    };
+
+    Sha256::Sha256() : context_(std::make_unique<Context>()) {
+        if(EVP_DigestInit_ex(context_->ctx, EVP_sha256(), nullptr) != 1) {
+            throw std::runtime_error("SHA-256 init failed!");
+        }
+    }
+
+    Sha256::~Sha256() = default;
+
+    void Sha256::update(const ubyte_t *data, size_t size) {
+        if(EVP_DigestUpdate(context_->ctx, data, size) != 1) {
+            throw std::runtime_error("SHA-256 update failed!");
         }
     }
 
+    sha256_t Sha256::finish() {
+        sha256_t sha_hash(s_size, 0);
+        if(EVP_DigestFinal_ex(context_->ctx, sha_hash.data(), nullptr) != 1) {
+            throw std::runtime_error("SHA-256 final failed!");
+        }
+        return sha_hash;
+    }
+
     sha256_t diff::Diff::calculateFileSha256(const std::string &file_path){
         std::ifstream ifs(file_path);
         char buffer[s_block_size_4k];
 
-        std::vector<ubyte_t> sha_hash(SHA256_DIGEST_LENGTH, 0);
-
-        SHA256_CTX ctx;
-        SHA256_Init(&ctx);
+        Sha256 sha;
 
         while(ifs.good()){
             ifs.read(buffer, s_block_size_4k);
-            SHA256_Update(&ctx, buffer, ifs.gcount());
+            sha.update(reinterpret_cast<const ubyte_t *>(buffer), ifs.gcount());
         }
-
-        SHA256_Final(sha_hash.data(), &ctx);
         ifs.close();
 
-        return sha_hash;
+        return sha.finish();
+    }
+
+    sha256_t Diff::calculateSha256(const ubyte_t *data, size_t size) {
+        Sha256 sha;
+        sha.update(data, size);
+        return sha.finish();
     }
 
     bool diff::Diff::compareSha(const sha256_t &hash1, const sha256_t &hash2) {
@@ -141,68 +475,170 @@ namespace diff {
     }
 
     void diff::Diff::generateSignatureFile(const std::string &file_path) {
-        std::vector<ubyte_t> buffer = signature_.serialize();
+        JDIFF_TRACE_SCOPE("generateSignatureFile");
+        std::vector<ubyte_t> buffer;
+        {
+            ScopedPhase serialization_phase(stats_, Stats::Phase::Serialization);
+            buffer = signature_.serialize();
+        }
 
+        ScopedPhase io_phase(stats_, Stats::Phase::Io);
         io::FileWriter file_writer(file_path);
         file_writer.append(buffer);
+        count(stats_, Stats::Counter::BytesWritten, buffer.size());
 
     }
 
     void diff::Diff::getSignatureFromFile(const std::string &file_path) {
+        JDIFF_TRACE_SCOPE("getSignatureFromFile");
 
         io::FileReader file_reader(file_path);
+        file_reader.setStats(stats_);
         std::vector<uint8_t> buffer = file_reader.getBuffer();
 
         if(buffer.empty()) {
             throw std::invalid_argument(std::string("File " + file_path + " empty!"));
         }
 
+        ScopedPhase serialization_phase(stats_, Stats::Phase::Serialization);
         signature_.deserialize(buffer);
     }
 
-    void diff::Diff::generateDeltaFile(const std::string &file_path) {
-        std::vector<uint8_t> buffer = delta_.serialize();
-
-        std::vector<ubyte_t> buff = delta_.serialize();
+    void diff::Diff::generateDeltaFile(const std::string &file_path, Compression compression,
+                                       io::FileReader *r_base_file) {
+        JDIFF_TRACE_SCOPE("generateDeltaFile");
+        delta_.compression = compression;
+        delta_.base_dictionary = r_base_file != nullptr;
+        std::vector<uint8_t> buffer;
+        {
+            ScopedPhase serialization_phase(stats_, Stats::Phase::Serialization);
+            buffer = delta_.serialize(r_base_file);
+        }
 
+        ScopedPhase io_phase(stats_, Stats::Phase::Io);
         io::FileWriter file_writer(file_path);
         file_writer.append(buffer);
+        count(stats_, Stats::Counter::BytesWritten, buffer.size());
     }
 
 
-    void diff::Diff::getDeltaFromFile(const std::string &file_path) {
+    void diff::Diff::getDeltaFromFile(const std::string &file_path, io::FileReader *r_base_file) {
+        JDIFF_TRACE_SCOPE("getDeltaFromFile");
 
         io::FileReader file_reader(file_path);
+        file_reader.setStats(stats_);
         std::vector<uint8_t> buffer = file_reader.getBuffer();
 
         if(buffer.empty()) {
             throw std::invalid_argument(std::string("File " + file_path + " is empty!"));
         }
 
-        delta_.deserialize(buffer);
+        ScopedPhase serialization_phase(stats_, Stats::Phase::Serialization);
+        delta_.deserialize(std::move(buffer), r_base_file);
     }
 
-    std::vector<ubyte_t> Delta::serialize() {
+    std::vector<ubyte_t> Delta::serialize(io::FileReader *r_base_file) const {
+        JDIFF_TRACE_SCOPE("Delta::serialize");
         std::vector<ubyte_t> buffer;
+        generic_push_back(buffer, s_magic);
+        generic_push_back(buffer, s_version);
         generic_push_back(buffer, sha.size());
         std::copy(sha.begin(), sha.end(), std::back_inserter(buffer));
         generic_push_back(buffer, block_size);
+        generic_push_back(buffer, static_cast<uint8_t>(chunking));
+        generic_push_back(buffer, static_cast<uint8_t>(format));
+        generic_push_back(buffer, static_cast<uint8_t>(compression));
+        generic_push_back(buffer, static_cast<uint8_t>(base_dictionary));
+
+        bool dictionary = base_dictionary && compression != Compression::None;
+        if(dictionary && r_base_file == nullptr) {
+            throw std::invalid_argument("Base dictionary compression needs base file!");
+        }
+        if(dictionary && format == DeltaFormat::Blocks && chunking != io::Chunking::Fixed) {
+            throw std::invalid_argument("Base dictionary compression needs fixed blocks!");
+        }
+
+        // compressed literals are moved to the payload at the end, records keep their sizes only. Payload is
+        // single frame, with base dictionary it's prefixed by its size and followed by one sized frame per
+        // long literal run (size 0 - run stored plain). Short runs gain nothing from base and stay in the first.
+        std::vector<ubyte_t> payload;
+        std::vector<ubyte_t> dictionary_frames;
+        std::unique_ptr<Compressor> compressor;
+        if(compression != Compression::None) {
+            compressor = std::make_unique<Compressor>(compression, payload);
+        }
+        auto push_literal = [&](const ubyte_t *data, size_t size, uint64_t anchor) {
+            if(dictionary && size >= s_dictionary_min_run) {
+                // long run replaces base data piece by piece, each piece gets base around its own position
+                for(size_t piece = 0; piece < size; piece += s_dictionary_piece) {
+                    size_t piece_size = std::min(s_dictionary_piece, size - piece);
+                    std::vector<ubyte_t> frame = compressWithDictionary(compression, data + piece, piece_size,
+                                                                        readDictionary(*r_base_file, anchor + piece));
+                    generic_push_back(dictionary_frames, frame.size());
+                    if(frame.empty()) {
+                        dictionary_frames.insert(dictionary_frames.end(), data + piece, data + piece + piece_size);
+                    } else {
+                        dictionary_frames.insert(dictionary_frames.end(), frame.begin(), frame.end());
+                    }
+                }
+            } else if(compressor) {
+                compressor->write(data, size);
+            } else {
+                buffer.insert(buffer.end(), data, data + size);
+            }
+        };
+
         generic_push_back(buffer, inserts.size());
         for (const auto&[index_key, bytes_value]: inserts){
             generic_push_back(buffer, index_key);
             generic_push_back(buffer, bytes_value.size());
-            std::copy(bytes_value.begin(), bytes_value.end(), std::back_inserter(buffer));
+            push_literal(bytes_value.data(), bytes_value.size(), index_key * block_size);
         }
         generic_push_back(buffer, deletes.size());
         for (const auto&[index_key, number_value]: deletes){
             generic_push_back(buffer, index_key);
             generic_push_back(buffer, number_value);
         }
+        generic_push_back(buffer, extensions.size());
+        for (const auto&[index_key, extension]: extensions){
+            generic_push_back(buffer, index_key);
+            generic_push_back(buffer, extension.head);
+            generic_push_back(buffer, extension.tail);
+        }
+        generic_push_back(buffer, instructions.size());
+        for (const auto &instruction: instructions){
+            generic_push_back(buffer, static_cast<uint8_t>(instruction.type));
+            generic_push_back(buffer, instruction.offset);
+            generic_push_back(buffer, instruction.length);
+        }
+        generic_push_back(buffer, literals.size());
+        if(dictionary) {
+            uint64_t anchor = 0;
+            for (const auto &instruction: instructions){
+                if(instruction.type == Instruction::Type::Copy) {
+                    anchor = instruction.offset + instruction.length;
+                } else {
+                    push_literal(literals.data() + instruction.offset, instruction.length, anchor);
+                }
+            }
+        } else {
+            push_literal(literals.data(), literals.size(), 0);
+        }
+        if(compressor) {
+            compressor->finish();
+            if(dictionary) {
+                generic_push_front(payload, payload.size());
+                payload.insert(payload.end(), dictionary_frames.begin(), dictionary_frames.end());
+            }
+            generic_push_back(buffer, payload.size());
+            std::copy(payload.begin(), payload.end(), std::back_inserter(buffer));
+        }
         generic_push_front(buffer, buffer.size());
         return buffer;
     }
 
-    void Delta::deserialize(std::vector<ubyte_t> buff) {
+    void Delta::deserialize(std::vector<ubyte_t> buff, io::FileReader *r_base_file) {
+        JDIFF_TRACE_SCOPE("Delta::deserialize");
         size_t offset = 0;
         size_t buff_size = 0;
         size_t sha_size = 0;
@@ -214,8 +650,11 @@ namespace diff {
             throw std::invalid_argument("Invalid buffer size!");
         }
 
+        readHeader(buff, offset, s_magic, s_version, "delta");
+
         generic_read_var_offset(buff, offset, sha_size);
         offset += sizeof(sha_size);
+        requireRemaining(buff, offset, sha_size);
         sha.resize(sha_size);
         std::copy(buff.begin()+offset, buff.begin()+offset+sha_size, sha.begin());
         offset += sha_size;
@@ -223,45 +662,207 @@ namespace diff {
         generic_read_var_offset(buff, offset, block_size);
         offset += sizeof(block_size);
 
+        chunking = readChunking(buff, offset);
+
+        uint8_t delta_format = 0;
+        generic_read_var_offset(buff, offset, delta_format);
+        offset += sizeof(delta_format);
+        if(delta_format > static_cast<uint8_t>(DeltaFormat::Instructions)){
+            throw std::invalid_argument("Unknown delta format!");
+        }
+        format = static_cast<DeltaFormat>(delta_format);
+        // patch steps over base by block size, zero would never move
+        if(format == DeltaFormat::Blocks && block_size == 0) {
+            throw std::invalid_argument("Block delta with zero block size!");
+        }
+
+        uint8_t delta_compression = 0;
+        generic_read_var_offset(buff, offset, delta_compression);
+        offset += sizeof(delta_compression);
+        if(delta_compression > static_cast<uint8_t>(Compression::Zstd)){
+            throw std::invalid_argument("Unknown delta compression!");
+        }
+        compression = static_cast<Compression>(delta_compression);
+        bool compressed = compression != Compression::None;
+
+        uint8_t delta_dictionary = 0;
+        generic_read_var_offset(buff, offset, delta_dictionary);
+        offset += sizeof(delta_dictionary);
+        base_dictionary = delta_dictionary != 0;
+        bool dictionary = base_dictionary && compressed;
+        if(dictionary && r_base_file == nullptr) {
+            throw std::invalid_argument("Delta literals are compressed with base file, base is needed!");
+        }
+
+        uint64_t declared_literals = 0;
         generic_read_var_offset(buff, offset, inserts_size);
         offset += sizeof(inserts_size);
         for(size_t i = 0; i < inserts_size; i++) {
-            uint32_t index = 0;
+            uint64_t index = 0;
             size_t bytes_size = 0;
             generic_read_var_offset(buff, offset, index);
             offset += sizeof(index);
             generic_read_var_offset(buff, offset, bytes_size);
             offset += sizeof(bytes_size);
-            inserts[index] = std::vector<ubyte_t>(bytes_size);
-            std::copy(buff.begin()+offset, buff.begin()+offset+bytes_size, inserts[index].begin());
-            offset += bytes_size;
+            requireLiterals(buff, offset, bytes_size, compression, declared_literals);
+            inserts[index].assign(bytes_size, 0);
+            if(!compressed) {
+                std::copy(buff.begin()+offset, buff.begin()+offset+bytes_size, inserts[index].begin());
+                offset += bytes_size;
+            }
         }
 
         generic_read_var_offset(buff, offset, deletes_size);
         offset += sizeof(deletes_size);
         for(size_t i = 0; i < deletes_size; i++) {
-            uint32_t index = 0;
-            uint32_t chunks_num = 0;
+            uint64_t index = 0;
+            uint64_t chunks_num = 0;
             generic_read_var_offset(buff, offset, index);
             offset += sizeof(index);
             generic_read_var_offset(buff, offset, chunks_num);
             offset += sizeof(chunks_num);
+            if(chunks_num == 0) {
+                throw std::invalid_argument("Delta deletes zero blocks!");
+            }
             deletes[index] = chunks_num;
         }
+
+        size_t extensions_size = 0;
+        generic_read_var_offset(buff, offset, extensions_size);
+        offset += sizeof(extensions_size);
+        for(size_t i = 0; i < extensions_size; i++) {
+            uint64_t index = 0;
+            Extension extension;
+            generic_read_var_offset(buff, offset, index);
+            offset += sizeof(index);
+            generic_read_var_offset(buff, offset, extension.head);
+            offset += sizeof(extension.head);
+            generic_read_var_offset(buff, offset, extension.tail);
+            offset += sizeof(extension.tail);
+            extensions[index] = extension;
+        }
+
+        size_t instructions_size = 0;
+        generic_read_var_offset(buff, offset, instructions_size);
+        offset += sizeof(instructions_size);
+        requireRemaining(buff, offset, instructions_size, Instruction::s_encoded_size);
+        instructions.resize(instructions_size);
+        for(auto &instruction : instructions) {
+            uint8_t type = 0;
+            instruction.offset = 0;
+            instruction.length = 0;
+            generic_read_var_offset(buff, offset, type);
+            offset += sizeof(type);
+            generic_read_var_offset(buff, offset, instruction.offset);
+            offset += sizeof(instruction.offset);
+            generic_read_var_offset(buff, offset, instruction.length);
+            offset += sizeof(instruction.length);
+            if (type != static_cast<uint8_t>(Instruction::Type::Copy) &&
+                type != static_cast<uint8_t>(Instruction::Type::Literal)) {
+                throw std::invalid_argument("Unknown delta instruction type!");
+            }
+            instruction.type = static_cast<Instruction::Type>(type);
+        }
+
+        size_t literals_size = 0;
+        generic_read_var_offset(buff, offset, literals_size);
+        offset += sizeof(literals_size);
+        requireLiterals(buff, offset, literals_size, compression, declared_literals);
+        literals.resize(literals_size);
+        if(!compressed) {
+            std::copy(buff.begin()+offset, buff.begin()+offset+literals_size, literals.begin());
+            offset += literals_size;
+        }
+
+        for(const auto &instruction : instructions) {
+            if(instruction.type == Instruction::Type::Literal &&
+               (instruction.length > literals.size() || instruction.offset > literals.size() - instruction.length)) {
+                throw std::invalid_argument("Delta literal out of range!");
+            }
+        }
+
+        if(compressed) {
+            size_t payload_size = 0;
+            generic_read_var_offset(buff, offset, payload_size);
+            offset += sizeof(payload_size);
+            if(payload_size > buff.size() - offset) {
+                throw std::invalid_argument("Compressed literals are truncated!");
+            }
+            if(dictionary) {
+                readDictionaryLiterals(*this, buff, offset, offset + payload_size, *r_base_file);
+            } else {
+                // literals are inflated straight into their records, frame is never decompressed whole
+                Decompressor decompressor(compression, buff.data() + offset, payload_size);
+                for(auto &[index, bytes] : inserts) {
+                    decompressor.read(bytes.data(), bytes.size());
+                }
+                decompressor.read(literals.data(), literals.size());
+                decompressor.finish();
+            }
+            offset += payload_size;
+        }
+    }
+
+
+    void Delta::addCopy(uint64_t base_offset, uint64_t length) {
+        if(length == 0) {
+            return;
+        }
+        if(!instructions.empty() && instructions.back().type == Instruction::Type::Copy &&
+           instructions.back().offset + instructions.back().length == base_offset) {
+            instructions.back().length += length;
+            return;
+        }
+        instructions.push_back({Instruction::Type::Copy, base_offset, length});
+    }
+
+    void Delta::addLiteral(const ubyte_t *data, uint64_t length) {
+        if(length == 0) {
+            return;
+        }
+        if(!instructions.empty() && instructions.back().type == Instruction::Type::Literal) {
+            instructions.back().length += length;
+        } else {
+            instructions.push_back({Instruction::Type::Literal, literals.size(), length});
+        }
+        literals.insert(literals.end(), data, data + length);
     }
 
     void Delta::clear() {
         sha.clear();
         block_size = 0;
+        chunking = io::Chunking::Fixed;
         inserts.clear();
         deletes.clear();
+        extensions.clear();
+        format = DeltaFormat::Blocks;
+        compression = Compression::None;
+        base_dictionary = false;
+        instructions.clear();
+        literals.clear();
     }
 
-    std::vector<ubyte_t> Signature::serialize() {
+    std::vector<ubyte_t> Signature::serialize() const {
+        JDIFF_TRACE_SCOPE("Signature::serialize");
         std::vector<ubyte_t> buffer;
+        generic_push_back(buffer, s_magic);
+        generic_push_back(buffer, s_version);
         generic_push_back(buffer, sha.size());
         std::copy(sha.begin(), sha.end(), std::back_inserter(buffer));
         generic_push_back(buffer, block_size);
+        generic_push_back(buffer, static_cast<uint8_t>(rolling_hash));
+        generic_push_back(buffer, static_cast<uint8_t>(chunking));
+        generic_push_back(buffer, block_count);
+        generic_push_back(buffer, file_size);
+        generic_push_back(buffer, super_block_factor);
+        generic_push_back(buffer, super_hashes.size());
+        for (const auto &super_hash: super_hashes){
+            generic_push_back(buffer, super_hash);
+        }
+        generic_push_back(buffer, block_hashes.size());
+        for (const auto &block_hash: block_hashes){
+            generic_push_back(buffer, block_hash);
+        }
         generic_push_back(buffer, signatures.size());
         for (const auto&[r_key, xx_value]: signatures){
             generic_push_back(buffer, r_key);
@@ -276,6 +877,7 @@ namespace diff {
     }
 
     void Signature::deserialize(std::vector<ubyte_t> buff) {
+        JDIFF_TRACE_SCOPE("Signature::deserialize");
         size_t offset = 0;
         size_t buff_size = 0;
         size_t sha_size = 0;
@@ -286,8 +888,11 @@ namespace diff {
             throw std::invalid_argument("Invalid buffer size!");
         }
 
+        readHeader(buff, offset, s_magic, s_version, "signature");
+
         generic_read_var_offset(buff,offset, sha_size);
         offset += sizeof(sha_size);
+        requireRemaining(buff, offset, sha_size);
         sha.resize(sha_size);
         std::copy(buff.begin()+offset, buff.begin()+offset+sha_size, sha.begin());
         offset += sha_size;
@@ -295,6 +900,47 @@ namespace diff {
         generic_read_var_offset(buff,offset, block_size);
         offset += sizeof(block_size);
 
+        uint8_t rolling_hash_type = 0;
+        generic_read_var_offset(buff,offset, rolling_hash_type);
+        offset += sizeof(rolling_hash_type);
+        if(rolling_hash_type > static_cast<uint8_t>(RollingHashType::BuzHash)){
+            throw std::invalid_argument("Unknown rolling hash type!");
+        }
+        rolling_hash = static_cast<RollingHashType>(rolling_hash_type);
+
+        chunking = readChunking(buff, offset);
+
+        block_count = 0;
+        generic_read_var_offset(buff,offset, block_count);
+        offset += sizeof(block_count);
+
+        file_size = 0;
+        generic_read_var_offset(buff,offset, file_size);
+        offset += sizeof(file_size);
+
+        size_t super_hashes_size = 0;
+        super_block_factor = 0;
+        generic_read_var_offset(buff,offset, super_block_factor);
+        offset += sizeof(super_block_factor);
+        generic_read_var_offset(buff,offset, super_hashes_size);
+        offset += sizeof(super_hashes_size);
+        requireRemaining(buff, offset, super_hashes_size, sizeof(uint64_t));
+        super_hashes.assign(super_hashes_size, 0);
+        for (auto &super_hash: super_hashes){
+            generic_read_var_offset(buff,offset, super_hash);
+            offset += sizeof(super_hash);
+        }
+
+        size_t block_hashes_size = 0;
+        generic_read_var_offset(buff,offset, block_hashes_size);
+        offset += sizeof(block_hashes_size);
+        requireRemaining(buff, offset, block_hashes_size, sizeof(uint64_t));
+        block_hashes.assign(block_hashes_size, 0);
+        for (auto &block_hash: block_hashes){
+            generic_read_var_offset(buff,offset, block_hash);
+            offset += sizeof(block_hash);
+        }
+
         generic_read_var_offset(buff,offset, signatures_size);
         offset += sizeof(signatures_size);
 
@@ -307,7 +953,7 @@ namespace diff {
             offset += sizeof(hashes_count);
             for(size_t j = 0; j < hashes_count; j++) {
                 uint64_t xxhash = 0;
-                uint32_t index = 0;
+                uint64_t index = 0;
                 generic_read_var_offset(buff, offset, xxhash);
                 offset += sizeof(xxhash);
                 generic_read_var_offset(buff, offset, index);
@@ -317,6 +963,15 @@ namespace diff {
         }
     }
 
+    uint64_t Signature::tailSize() const {
+        if(chunking != io::Chunking::Fixed || block_size == 0 || block_count == 0 ||
+           file_size <= (block_count - 1) * block_size) {
+            return 0;
+        }
+        uint64_t tail_size = file_size - (block_count - 1) * block_size;
+        return tail_size < block_size ? tail_size : 0;
+    }
+
     uint64_t Signature::countSignatures(){
         uint64_t sig_count = 0;
         for (const auto&[r_key, xx_value]: signatures){
@@ -327,13 +982,26 @@ namespace diff {
         return sig_count;
     }
 
-    void Signature::addSignature(uint32_t rhash, uint64_t xxhash, uint32_t index) {
-        signatures[rhash][xxhash] = index;
+    void Signature::addSignature(uint32_t rhash, uint64_t xxhash, uint64_t index) {
+        // duplicated blocks keep the first index, later ones are reached through block_hashes
+        signatures[rhash].try_emplace(xxhash, index);
+        block_count = std::max(block_count, index + 1);
+        if(block_hashes.size() < block_count) {
+            block_hashes.resize(block_count);
+        }
+        block_hashes[index] = xxhash;
     }
 
     void Signature::clear() {
         sha.clear();
         block_size = 0;
+        rolling_hash = RollingHashType::Adler;
+        chunking = io::Chunking::Fixed;
+        block_count = 0;
+        file_size = 0;
+        super_block_factor = 0;
+        super_hashes.clear();
+        block_hashes.clear();
         signatures.clear();
     }
 }
\ No newline at end of file
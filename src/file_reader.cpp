@@ -1,4 +1,5 @@
 #include "file_reader.hpp"
+#include "trace.hpp"
 
 #include <iostream>
 
@@ -8,17 +9,19 @@ namespace io {
         rolled_out_ = 0;
     }
 
-    FileReader::FileReader(const std::string &file_path, uint16_t block_size) {
+    FileReader::FileReader(const std::string &file_path, uint32_t block_size, Chunking chunking) {
         is_ = std::ifstream(file_path, std::ios_base::binary);
         if(!is_){
             throw std::invalid_argument(std::string("File " + file_path + " doesn't exist or broken!"));
         }
+        file_path_ = file_path;
         if(block_size > 0) {
             max_frame_size_ = block_size;
         } else {
             max_frame_size_ = calculateBlockSize(std::filesystem::file_size(file_path));
         }
         rolled_out_ = 0;
+        chunking_ = chunking;
     }
 
     FileReader::FileReader(const std::string &file_path) {
@@ -26,6 +29,7 @@ namespace io {
         if(!is_){
             throw std::invalid_argument(std::string("File " + file_path + " doesn't exist or broken!"));
         }
+        file_path_ = file_path;
 
         rolled_out_ = 0;
         max_frame_size_ = calculateBlockSize(std::filesystem::file_size(file_path));
@@ -36,47 +40,125 @@ namespace io {
     }
 
     bool FileReader::rollByte() {
-        if (frame_.size() == max_frame_size_) {
-            rolled_out_ = frame_.front();
-            frame_.pop_front();
-        }
-
         char c;
         if (is_.get(c)) {
-            frame_.push_back(c);
+            pushFrameByte(c);
+            diff::count(stats_, diff::Stats::Counter::BytesRead);
             return true;
         } else {
             return false;
         }
     }
 
+    void FileReader::clearFrame() {
+        frame_head_ = 0;
+        frame_size_ = 0;
+    }
+
     std::vector<unsigned char> FileReader::getNextChunk() {
-        std::vector<unsigned char> chunk(max_frame_size_);
+        std::vector<unsigned char> chunk;
+        getNextChunk(chunk);
+        return chunk;
+    }
+
+    void FileReader::getNextChunk(std::vector<unsigned char> &chunk) {
+        if (chunking_ == Chunking::ContentDefined) {
+            getNextContentDefinedChunk(chunk);
+            return;
+        }
+
+        JDIFF_TRACE_IO_SCOPE("FileReader::getNextChunk");
+        diff::ScopedPhase io_phase(stats_, diff::Stats::Phase::Io);
+        chunk.resize(max_frame_size_);
         is_.read((char*)chunk.data(), static_cast<long>(chunk.size()));
 
         auto data_count = is_.gcount();
-        if (max_frame_size_ > data_count) {
-            chunk.resize(data_count);
-            chunk.shrink_to_fit();
+        diff::count(stats_, diff::Stats::Counter::BytesRead, data_count);
+        chunk.resize(data_count);
+    }
+
+    std::vector<unsigned char> FileReader::peek(size_t length) {
+        std::vector<unsigned char> data;
+        peek(length, data);
+        return data;
+    }
+
+    void FileReader::peek(size_t length, std::vector<unsigned char> &data) {
+        JDIFF_TRACE_IO_SCOPE("FileReader::peek");
+        diff::ScopedPhase io_phase(stats_, diff::Stats::Phase::Io);
+        auto position = is_.tellg();
+        if (position < 0) {
+            data.clear();
+            return;
         }
 
-        return chunk;
+        data.resize(length);
+        is_.read((char*)data.data(), static_cast<long>(length));
+        data.resize(is_.gcount());
+        diff::count(stats_, diff::Stats::Counter::BytesRead, data.size());
+        is_.clear();
+        is_.seekg(position);
     }
 
-    std::vector<unsigned char> FileReader::getCurrentFrame() {
-        return std::vector<unsigned char>{frame_.begin(), frame_.end()};
+    std::vector<unsigned char> FileReader::readAt(uint64_t offset, size_t length) {
+        std::vector<unsigned char> data;
+        readAt(offset, length, data);
+        return data;
+    }
+
+    void FileReader::readAt(uint64_t offset, size_t length, std::vector<unsigned char> &data) {
+        JDIFF_TRACE_IO_SCOPE("FileReader::readAt");
+        diff::ScopedPhase io_phase(stats_, diff::Stats::Phase::Io);
+        data.resize(length);
+        is_.clear();
+        is_.seekg(static_cast<long>(offset));
+        is_.read((char*)data.data(), static_cast<long>(length));
+        data.resize(is_.gcount());
+        diff::count(stats_, diff::Stats::Counter::BytesRead, data.size());
+        is_.clear();
+    }
+
+    void FileReader::skip(size_t length) {
+        is_.seekg(static_cast<long>(length), std::ios_base::cur);
+        clearFrame();
+        rolled_out_ = 0;
     }
 
-    char FileReader::getLatestByte() {
-        return frame_.back();
+    void FileReader::getNextContentDefinedChunk(std::vector<unsigned char> &chunk) {
+        FastCDC cdc(max_frame_size_);
+
+        size_t available = pending_.size() - pending_offset_;
+        if (available < cdc.max_size() && is_) {
+            diff::ScopedPhase io_phase(stats_, diff::Stats::Phase::Io);
+            JDIFF_TRACE_IO_SCOPE("FileReader::getNextChunk");
+            pending_.erase(pending_.begin(), pending_.begin() + static_cast<long>(pending_offset_));
+            pending_offset_ = 0;
+            pending_.resize(cdc.max_size());
+            is_.read((char*)pending_.data() + available, static_cast<long>(cdc.max_size() - available));
+            pending_.resize(available + is_.gcount());
+            diff::count(stats_, diff::Stats::Counter::BytesRead, is_.gcount());
+            available = pending_.size();
+        }
+
+        size_t length;
+        {
+            diff::ScopedPhase hashing_phase(stats_, diff::Stats::Phase::Hashing);
+            length = cdc.cutPoint(pending_.data() + pending_offset_, available);
+        }
+        auto begin = pending_.begin() + static_cast<long>(pending_offset_);
+        chunk.assign(begin, begin + static_cast<long>(length));
+        pending_offset_ += length;
     }
 
-    char FileReader::getRolledOutByte() const {
-        return rolled_out_;
+    std::vector<unsigned char> FileReader::getCurrentFrame() {
+        return std::vector<unsigned char>(frameData(), frameData() + frameSize());
     }
 
     std::vector<uint8_t> FileReader::getBuffer(){
-        return std::vector<uint8_t>{(std::istreambuf_iterator<char>(is_)),
-                                 std::istreambuf_iterator<char>()};
+        JDIFF_TRACE_IO_SCOPE("FileReader::getBuffer");
+        diff::ScopedPhase io_phase(stats_, diff::Stats::Phase::Io);
+        std::vector<uint8_t> buffer{(std::istreambuf_iterator<char>(is_)), std::istreambuf_iterator<char>()};
+        diff::count(stats_, diff::Stats::Counter::BytesRead, buffer.size());
+        return buffer;
     }
 }
\ No newline at end of file
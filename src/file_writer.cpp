@@ -1,17 +1,32 @@
 #include "file_writer.hpp"
+#include "trace.hpp"
+#include <filesystem>
 #include <fstream>
 
 namespace io {
 
     FileWriter::FileWriter(const std::string &file_path) {
         os_ = std::ofstream(file_path, std::ios_base::binary);
+        file_path_ = file_path;
     }
 
     FileWriter::~FileWriter() {
         os_.close();
     }
 
-    void FileWriter::append(const std::vector<unsigned char> &data) {
-        os_.write((char*)&data[0], data.size());
+    void FileWriter::append(const unsigned char *data, size_t size) {
+        JDIFF_TRACE_IO_SCOPE("FileWriter::append");
+        os_.write((char*)data, static_cast<long>(size));
+    }
+
+    void FileWriter::writeAt(uint64_t offset, const std::vector<unsigned char> &data) {
+        JDIFF_TRACE_IO_SCOPE("FileWriter::writeAt");
+        os_.seekp(static_cast<long>(offset));
+        os_.write((char*)data.data(), static_cast<long>(data.size()));
+    }
+
+    void FileWriter::resize(uint64_t size) {
+        os_.flush();
+        std::filesystem::resize_file(file_path_, size);
     }
 }
\ No newline at end of file
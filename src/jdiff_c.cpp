@@ -0,0 +1,264 @@
+#include "jdiff.h"
+#include "buffer_api.hpp"
+
+#include <cstring>
+#include <string>
+
+// Fed input is copied and kept whole until finish, engine then runs over it in memory (documented in jdiff.h)
+struct jdiff_signature {
+    uint32_t block_size = 0;
+    uint32_t flags = 0;
+    bool finished = false;
+    std::vector<std::byte> input;
+    diff::Signature signature;
+};
+
+struct jdiff_delta {
+    bool finished = false;
+    std::vector<std::byte> input;
+    diff::Signature signature;
+    diff::Delta delta;
+};
+
+namespace {
+    thread_local std::string t_last_error;
+
+    // Runs f, exceptions never cross the C boundary
+    template<typename F>
+    int guarded(F &&f) {
+        try {
+            t_last_error.clear();
+            return f();
+        } catch (const std::invalid_argument &e) {
+            t_last_error = e.what();
+            return JDIFF_INVALID_ARGUMENT;
+        } catch (const std::exception &e) {
+            t_last_error = e.what();
+            return JDIFF_ERROR;
+        } catch (...) {
+            t_last_error = "Unknown error!";
+            return JDIFF_ERROR;
+        }
+    }
+
+    template<typename T, typename F>
+    T * guardedCreate(F &&f) {
+        T *result = nullptr;
+        guarded([&] {
+            result = f();
+            return JDIFF_OK;
+        });
+        return result;
+    }
+
+    int fail(int status, const char *message) {
+        t_last_error = message;
+        return status;
+    }
+
+    int feed(bool finished, std::vector<std::byte> &input, const void *data, size_t size) {
+        if (finished) {
+            return fail(JDIFF_INVALID_STATE, "Input already finished!");
+        }
+        if (!data && size > 0) {
+            return fail(JDIFF_INVALID_ARGUMENT, "Data is null!");
+        }
+        auto bytes = static_cast<const std::byte *>(data);
+        input.insert(input.end(), bytes, bytes + size);
+        return JDIFF_OK;
+    }
+
+    // Copies serialized bytes when they fit, stores their size either way
+    int copyOut(const std::vector<diff::ubyte_t> &bytes, void *buffer, size_t capacity, size_t *written) {
+        if (!written || (!buffer && capacity > 0)) {
+            return fail(JDIFF_INVALID_ARGUMENT, "Output buffer or size pointer is null!");
+        }
+        *written = bytes.size();
+        if (bytes.size() > capacity) {
+            return fail(JDIFF_BUFFER_TOO_SMALL, "Output buffer too small!");
+        }
+        std::memcpy(buffer, bytes.data(), bytes.size());
+        return JDIFF_OK;
+    }
+
+    std::span<const std::byte> bytesOf(const void *data, size_t size) {
+        return {static_cast<const std::byte *>(data), size};
+    }
+}
+
+extern "C" {
+
+uint32_t jdiff_abi_version(void) {
+    return JDIFF_ABI_VERSION;
+}
+
+const char *jdiff_last_error(void) {
+    return t_last_error.c_str();
+}
+
+jdiff_signature *jdiff_signature_create(uint32_t block_size, uint32_t flags) {
+    return guardedCreate<jdiff_signature>([&] {
+        auto *signature = new jdiff_signature;
+        signature->block_size = block_size;
+        signature->flags = flags;
+        return signature;
+    });
+}
+
+int jdiff_signature_feed(jdiff_signature *signature, const void *data, size_t size) {
+    if (!signature) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Signature is null!");
+    }
+    return guarded([&] { return feed(signature->finished, signature->input, data, size); });
+}
+
+int jdiff_signature_finish(jdiff_signature *signature) {
+    if (!signature) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Signature is null!");
+    }
+    if (signature->finished) {
+        return fail(JDIFF_INVALID_STATE, "Signature already finished!");
+    }
+    return guarded([&] {
+        diff::SignatureOptions options;
+        options.block_size = signature->block_size;
+        options.sha = (signature->flags & JDIFF_FLAG_SHA) != 0;
+        options.chunking = (signature->flags & JDIFF_FLAG_CDC) ? io::Chunking::ContentDefined : io::Chunking::Fixed;
+        signature->signature = diff::makeSignature(signature->input, options);
+        signature->finished = true;
+        std::vector<std::byte>().swap(signature->input);
+        return JDIFF_OK;
+    });
+}
+
+int jdiff_signature_serialize(const jdiff_signature *signature, void *buffer, size_t capacity, size_t *written) {
+    if (!signature) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Signature is null!");
+    }
+    if (!signature->finished) {
+        return fail(JDIFF_INVALID_STATE, "Signature isn't finished!");
+    }
+    return guarded([&] { return copyOut(signature->signature.serialize(), buffer, capacity, written); });
+}
+
+jdiff_signature *jdiff_signature_load(const void *data, size_t size) {
+    if (!data) {
+        fail(JDIFF_INVALID_ARGUMENT, "Data is null!");
+        return nullptr;
+    }
+    return guardedCreate<jdiff_signature>([&] {
+        auto *signature = new jdiff_signature;
+        try {
+            signature->signature = diff::deserializeSignature(bytesOf(data, size));
+        } catch (...) {
+            delete signature;
+            throw;
+        }
+        signature->block_size = signature->signature.block_size;
+        signature->finished = true;
+        return signature;
+    });
+}
+
+void jdiff_signature_free(jdiff_signature *signature) {
+    delete signature;
+}
+
+jdiff_delta *jdiff_delta_create(const jdiff_signature *signature) {
+    if (!signature) {
+        fail(JDIFF_INVALID_ARGUMENT, "Signature is null!");
+        return nullptr;
+    }
+    if (!signature->finished) {
+        fail(JDIFF_INVALID_STATE, "Signature isn't finished!");
+        return nullptr;
+    }
+    return guardedCreate<jdiff_delta>([&] {
+        auto *delta = new jdiff_delta;
+        delta->signature = signature->signature;
+        return delta;
+    });
+}
+
+int jdiff_delta_feed(jdiff_delta *delta, const void *data, size_t size) {
+    if (!delta) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Delta is null!");
+    }
+    return guarded([&] { return feed(delta->finished, delta->input, data, size); });
+}
+
+int jdiff_delta_finish(jdiff_delta *delta) {
+    if (!delta) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Delta is null!");
+    }
+    if (delta->finished) {
+        return fail(JDIFF_INVALID_STATE, "Delta already finished!");
+    }
+    return guarded([&] {
+        delta->delta = diff::makeDelta(delta->signature, delta->input, !delta->signature.sha.empty());
+        delta->finished = true;
+        std::vector<std::byte>().swap(delta->input);
+        delta->signature.clear();
+        return JDIFF_OK;
+    });
+}
+
+int jdiff_delta_serialize(const jdiff_delta *delta, void *buffer, size_t capacity, size_t *written) {
+    if (!delta) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Delta is null!");
+    }
+    if (!delta->finished) {
+        return fail(JDIFF_INVALID_STATE, "Delta isn't finished!");
+    }
+    return guarded([&] { return copyOut(delta->delta.serialize(), buffer, capacity, written); });
+}
+
+jdiff_delta *jdiff_delta_load(const void *data, size_t size) {
+    if (!data) {
+        fail(JDIFF_INVALID_ARGUMENT, "Data is null!");
+        return nullptr;
+    }
+    return guardedCreate<jdiff_delta>([&] {
+        auto *delta = new jdiff_delta;
+        try {
+            delta->delta = diff::deserializeDelta(bytesOf(data, size));
+        } catch (...) {
+            delete delta;
+            throw;
+        }
+        delta->finished = true;
+        return delta;
+    });
+}
+
+void jdiff_delta_free(jdiff_delta *delta) {
+    delete delta;
+}
+
+int jdiff_patch(const jdiff_delta *delta, const void *base, size_t base_size, uint32_t flags,
+                void *output, size_t capacity, size_t *written) {
+    if (!delta) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Delta is null!");
+    }
+    if (!delta->finished) {
+        return fail(JDIFF_INVALID_STATE, "Delta isn't finished!");
+    }
+    if ((!base && base_size > 0) || (!output && capacity > 0) || !written) {
+        return fail(JDIFF_INVALID_ARGUMENT, "Base, output or size pointer is null!");
+    }
+    return guarded([&] {
+        // output past capacity is only counted, caller learns the size to retry with
+        size_t size = 0;
+        auto *out = static_cast<std::byte *>(output);
+        diff::applyDelta(delta->delta, bytesOf(base, base_size), [&](std::span<const std::byte> data) {
+            if (size + data.size() <= capacity) {
+                std::memcpy(out + size, data.data(), data.size());
+            }
+            size += data.size();
+        }, (flags & JDIFF_FLAG_SHA) != 0);
+        *written = size;
+        return size > capacity ? fail(JDIFF_BUFFER_TOO_SMALL, "Output buffer too small!") : JDIFF_OK;
+    });
+}
+
+}
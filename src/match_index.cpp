@@ -0,0 +1,104 @@
+#include "match_index.hpp"
+
+#include <algorithm>
+#include <thread>
+#include "rolling_hash.hpp"
+#include "trace.hpp"
+
+namespace diff {
+    static bool entryLess(const MatchIndex::Entry &a, const MatchIndex::Entry &b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.offset < b.offset;
+    }
+
+    MatchIndex::MatchIndex(const std::vector<unsigned char> &base, unsigned threads) : base_(base) {
+        uint64_t seeds = base.size() >= s_seed_size ? base.size() - s_seed_size + 1 : 0;
+        stride_ = std::max<uint64_t>(1, (seeds + s_max_entries - 1) / s_max_entries);
+        if (seeds == 0) {
+            return;
+        }
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        uint64_t max_threads = std::max<uint64_t>(1, base.size() / s_min_slice_size);
+        threads = static_cast<unsigned>(std::min<uint64_t>(threads, max_threads));
+
+        // slices start on stride boundaries, so sampled offsets don't depend on thread count
+        uint64_t strides = (seeds + stride_ - 1) / stride_;
+        uint64_t strides_per_slice = (strides + threads - 1) / threads;
+        std::vector<std::vector<Entry>> slices(threads);
+        std::vector<std::thread> workers;
+
+        auto slice_begin = [&](uint64_t t) { return std::min(seeds, t * strides_per_slice * stride_); };
+        for (unsigned t = 1; t < threads; t++) {
+            workers.emplace_back(&MatchIndex::indexSlice, this, slice_begin(t), slice_begin(t + 1),
+                                 std::ref(slices[t]));
+        }
+        indexSlice(slice_begin(0), slice_begin(1), slices[0]);
+        for (auto &worker : workers) {
+            worker.join();
+        }
+
+        size_t total = 0;
+        for (const auto &slice : slices) {
+            total += slice.size();
+        }
+        entries_.reserve(total);
+        for (const auto &slice : slices) {
+            auto middle = entries_.insert(entries_.end(), slice.begin(), slice.end());
+            std::inplace_merge(entries_.begin(), middle, entries_.end(), entryLess);
+        }
+    }
+
+    void MatchIndex::indexSlice(uint64_t first_seed, uint64_t last_seed, std::vector<Entry> &entries) const {
+        JDIFF_TRACE_SCOPE("MatchIndex::indexSlice");
+        if (first_seed >= last_seed) {
+            return;
+        }
+
+        entries.reserve((last_seed - first_seed + stride_ - 1) / stride_);
+        RabinKarpHash rhash(s_seed_size);
+        for (uint64_t i = first_seed; i < first_seed + s_seed_size - 1; i++) {
+            rhash.roll(0, static_cast<char>(base_[i]));
+        }
+
+        for (uint64_t seed = first_seed; seed < last_seed; seed++) {
+            char oldest = seed > first_seed ? static_cast<char>(base_[seed - 1]) : 0;
+            rhash.roll(oldest, static_cast<char>(base_[seed + s_seed_size - 1]));
+            if (seed % stride_ == 0) {
+                entries.push_back({rhash.hash(), seed});
+            }
+        }
+        std::sort(entries.begin(), entries.end(), entryLess);
+    }
+
+    MatchIndex::Match MatchIndex::find(const std::vector<unsigned char> &target, uint64_t target_offset,
+                                       uint32_t seed_hash, uint64_t min_target_offset) const {
+        Match best;
+        auto range = std::equal_range(entries_.begin(), entries_.end(), Entry{seed_hash, 0},
+                                      [](const Entry &a, const Entry &b) { return a.hash < b.hash; });
+
+        size_t candidates = 0;
+        for (auto it = range.first; it != range.second && candidates < s_max_candidates; ++it, ++candidates) {
+            uint64_t forward = 0;
+            while (it->offset + forward < base_.size() && target_offset + forward < target.size() &&
+                   base_[it->offset + forward] == target[target_offset + forward]) {
+                forward++;
+            }
+            if (forward < s_seed_size) {
+                continue;
+            }
+
+            uint64_t backward = 0;
+            while (backward < it->offset && backward < target_offset - min_target_offset &&
+                   base_[it->offset - backward - 1] == target[target_offset - backward - 1]) {
+                backward++;
+            }
+
+            if (forward + backward > best.length) {
+                best = {target_offset - backward, it->offset - backward, forward + backward};
+            }
+        }
+        return best;
+    }
+}
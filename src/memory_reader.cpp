@@ -0,0 +1,42 @@
+#include "memory_reader.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace io {
+    MmapReader::MmapReader(const std::string &file_path, uint32_t block_size, Chunking chunking) {
+        int fd = open(file_path.c_str(), O_RDONLY);
+        struct stat status{};
+        if (fd < 0 || fstat(fd, &status) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw std::invalid_argument(std::string("File " + file_path + " doesn't exist or broken!"));
+        }
+
+        mapping_size_ = static_cast<size_t>(status.st_size);
+        // empty file can't be mapped, it's read as empty buffer
+        if (mapping_size_ > 0) {
+            mapping_ = mmap(nullptr, mapping_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapping_ == MAP_FAILED) {
+            mapping_ = nullptr;
+            throw std::invalid_argument(std::string("File " + file_path + " can't be mapped!"));
+        }
+        if (mapping_) {
+            madvise(mapping_, mapping_size_, MADV_SEQUENTIAL);
+        }
+
+        file_path_ = file_path;
+        reset(static_cast<const unsigned char *>(mapping_), mapping_size_, block_size, chunking);
+    }
+
+    MmapReader::~MmapReader() {
+        if (mapping_) {
+            munmap(mapping_, mapping_size_);
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#include "patched_view.hpp"
+
+#include <algorithm>
+
+namespace diff {
+    // end of [offset, offset + length) clamped to size, huge lengths don't wrap around
+    static uint64_t clampedEnd(uint64_t offset, uint64_t length, uint64_t size) {
+        return offset >= size ? size : offset + std::min(length, size - offset);
+    }
+
+    PatchedView::PatchedView(Delta delta, io::FileReader &r_base_file, uint64_t base_size)
+            : delta_(delta.format == DeltaFormat::Instructions ? std::move(delta) : Diff::toInstructions(delta, base_size)),
+              r_base_file_(r_base_file) {
+        size_ = 0;
+        starts_.reserve(delta_.instructions.size());
+        for (const auto &instruction : delta_.instructions) {
+            starts_.push_back(size_);
+            size_ += instruction.length;
+        }
+    }
+
+    void PatchedView::writeRanges(const std::vector<ByteRange> &ranges, io::FileWriter &writer) const {
+        writer.resize(size_);
+        for (const auto &range : ranges) {
+            uint64_t end = clampedEnd(range.offset, range.length, size_);
+            for (uint64_t offset = range.offset; offset < end; offset += s_write_chunk_size) {
+                writer.writeAt(offset, read(offset, std::min<uint64_t>(s_write_chunk_size, end - offset)));
+            }
+        }
+    }
+
+    std::vector<ubyte_t> PatchedView::read(uint64_t offset, uint64_t length) const {
+        std::vector<ubyte_t> data;
+        if (offset >= size_) {
+            return data;
+        }
+
+        uint64_t end = clampedEnd(offset, length, size_);
+        data.reserve(end - offset);
+        auto i = static_cast<size_t>(std::upper_bound(starts_.begin(), starts_.end(), offset) - starts_.begin() - 1);
+
+        for (uint64_t position = offset; position < end; i++) {
+            const Instruction &instruction = delta_.instructions[i];
+            uint64_t skip = position - starts_[i];
+            uint64_t piece = std::min(instruction.length - skip, end - position);
+
+            if (instruction.type == Instruction::Type::Literal) {
+                auto begin = delta_.literals.begin() + static_cast<long>(instruction.offset + skip);
+                data.insert(data.end(), begin, begin + static_cast<long>(piece));
+            } else {
+                std::vector<ubyte_t> copied = r_base_file_.readAt(instruction.offset + skip, piece);
+                if (copied.size() != piece) {
+                    throw std::invalid_argument("Delta copies data beyond the base file!");
+                }
+                data.insert(data.end(), copied.begin(), copied.end());
+            }
+            position += piece;
+        }
+        return data;
+    }
+}
@@ -0,0 +1,93 @@
+#include "stats.hpp"
+
+#include <sys/resource.h>
+#include <iomanip>
+
+namespace diff {
+    static uint64_t phasesTotal(const Stats &stats) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < static_cast<size_t>(Stats::Phase::Count); i++) {
+            total += stats.nanoseconds(static_cast<Stats::Phase>(i));
+        }
+        return total;
+    }
+
+    // I/O bound when reading and writing took longer than all CPU phases together
+    static const char * bound(const Stats &stats) {
+        uint64_t io = stats.nanoseconds(Stats::Phase::Io);
+        return io > phasesTotal(stats) - io ? "io" : "cpu";
+    }
+
+    void Stats::print(std::ostream &os, uint64_t wall_ns) const {
+        os << "Counters:" << std::endl;
+        for (size_t i = 0; i < static_cast<size_t>(Counter::Count); i++) {
+            os << "  " << std::left << std::setw(20) << counterName(static_cast<Counter>(i)) << std::right
+               << std::setw(16) << counters_[i] << std::endl;
+        }
+
+        uint64_t other = wall_ns > phasesTotal(*this) ? wall_ns - phasesTotal(*this) : 0;
+        os << "Time (ms):" << std::endl << std::fixed << std::setprecision(3);
+        auto print_phase = [&](const char *name, uint64_t ns) {
+            double share = wall_ns > 0 ? 100.0 * static_cast<double>(ns) / static_cast<double>(wall_ns) : 0;
+            os << "  " << std::left << std::setw(20) << name << std::right << std::setw(16)
+               << static_cast<double>(ns) / 1e6 << std::setw(10) << std::setprecision(1) << share << " %"
+               << std::setprecision(3) << std::endl;
+        };
+        for (size_t i = 0; i < static_cast<size_t>(Phase::Count); i++) {
+            print_phase(phaseName(static_cast<Phase>(i)), phases_ns_[i]);
+        }
+        print_phase("other", other);
+        print_phase("wall", wall_ns);
+
+        os << "Peak RSS: " << peakRssKib() << " KiB" << std::endl;
+        os << "Bound: " << bound(*this) << std::endl;
+    }
+
+    void Stats::printJson(std::ostream &os, uint64_t wall_ns) const {
+        os << "{\"counters\": {";
+        for (size_t i = 0; i < static_cast<size_t>(Counter::Count); i++) {
+            os << (i ? ", " : "") << "\"" << counterName(static_cast<Counter>(i)) << "\": " << counters_[i];
+        }
+        os << "}, \"time_ns\": {";
+        for (size_t i = 0; i < static_cast<size_t>(Phase::Count); i++) {
+            os << (i ? ", " : "") << "\"" << phaseName(static_cast<Phase>(i)) << "\": " << phases_ns_[i];
+        }
+        os << ", \"wall\": " << wall_ns << "}, \"peak_rss_kib\": " << peakRssKib()
+           << ", \"bound\": \"" << bound(*this) << "\"}" << std::endl;
+    }
+
+    const char * Stats::counterName(Counter counter) {
+        switch (counter) {
+            case Counter::BytesRead: return "bytes_read";
+            case Counter::BytesWritten: return "bytes_written";
+            case Counter::BlocksHashed: return "blocks_hashed";
+            case Counter::RollingPositions: return "rolling_positions";
+            case Counter::WeakHits: return "weak_hits";
+            case Counter::StrongHits: return "strong_hits";
+            case Counter::FalseWeakHits: return "false_weak_hits";
+            case Counter::LiteralBytes: return "literal_bytes";
+            case Counter::CopiedBlocks: return "copied_blocks";
+            case Counter::CopiedBytes: return "copied_bytes";
+            case Counter::Count: break;
+        }
+        return "";
+    }
+
+    const char * Stats::phaseName(Phase phase) {
+        switch (phase) {
+            case Phase::Io: return "io";
+            case Phase::Hashing: return "hashing";
+            case Phase::Lookup: return "lookup";
+            case Phase::Serialization: return "serialization";
+            case Phase::Count: break;
+        }
+        return "";
+    }
+
+    long Stats::peakRssKib() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        // kilobytes on Linux
+        return usage.ru_maxrss;
+    }
+}
@@ -2,55 +2,104 @@
 #include "catch.hpp"
 #include "diff.hpp"
 #include "xxhash64.h"
+#include "rolling_hash.hpp"
+#include "block_size_tuner.hpp"
+#include "patched_view.hpp"
+#include "match_index.hpp"
+#include "trace.hpp"
+#include "buffer_api.hpp"
+#include "batch.hpp"
+#include "jdiff.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <thread>
 
 static inline constexpr uint16_t s_block_size = 4;
 
+// Counts heap allocations of the test binary, so hot loops can be checked to not allocate
+static std::atomic<uint64_t> s_allocations = 0;
+
+void * operator new(size_t size) {
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
 class MockReader : public io::FileReader {
 public:
     explicit MockReader(std::vector<diff::ubyte_t> data) {
         block_size_ = s_block_size;
+        max_frame_size_ = s_block_size;
         std::move(data.begin(), data.end(), std::back_inserter(data_));
         index = 0;
     }
 
     ~MockReader() override = default;
 
-    std::vector<diff::ubyte_t> getNextChunk() override{
-        std::vector<diff::ubyte_t> ret_buf;
+    using io::FileReader::getNextChunk;
+    using io::FileReader::peek;
+    using io::FileReader::readAt;
+
+    void getNextChunk(std::vector<diff::ubyte_t> &chunk) override{
+        chunk.clear();
 
-        if(index >= data_.size()) return {};
+        if(index >= data_.size()) return;
 
         if((index + block_size_) < data_.size()) {
-            std::copy(data_.begin()+index,
-                      data_.begin()+index+block_size_,
-                      std::back_inserter(ret_buf));
+            chunk.assign(data_.begin()+index, data_.begin()+index+block_size_);
         } else {
-            std::copy(data_.begin()+index,
-                      data_.end(),
-                      std::back_inserter(ret_buf));
+            chunk.assign(data_.begin()+index, data_.end());
         }
         index += block_size_;
-
-        return ret_buf;
     }
 
     bool rollByte() override{
-
-        if (frame_.size() == block_size_) {
-            rolled_out_ = frame_.front();
-            frame_.pop_front();
-        }
-
         if(index < data_.size()){
-            frame_.push_back((char)data_[index++]);
+            pushFrameByte((char)data_[index++]);
             return true;
         } else {
             return false;
         }
     }
 
+    void peek(size_t length, std::vector<diff::ubyte_t> &data) override{
+        data.clear();
+        size_t end = std::min<size_t>(data_.size(), index + length);
+        if(index >= end) return;
+        data.assign(data_.begin()+index, data_.begin()+end);
+    }
+
+    void readAt(uint64_t offset, size_t length, std::vector<diff::ubyte_t> &data) override{
+        data.clear();
+        size_t end = std::min<size_t>(data_.size(), offset + length);
+        if(offset >= end) return;
+        data.assign(data_.begin()+static_cast<long>(offset), data_.begin()+static_cast<long>(end));
+    }
+
+    void skip(size_t length) override{
+        index += length;
+        clearFrame();
+        rolled_out_ = 0;
+        skipped_blocks++;
+    }
+
     const uint16_t & block_size() const { return block_size_; }
 
+    size_t skipped_blocks = 0;
+
 private:
     uint16_t index;
     uint16_t block_size_;
@@ -61,8 +110,21 @@ class MockWriter : public io::FileWriter {
 public:
     MockWriter() = default;
 
-    void append(const std::vector<unsigned char> &data) override{
-        std::copy(data.begin(), data.end(), std::back_inserter(data_));
+    using io::FileWriter::append;
+
+    void append(const unsigned char *data, size_t size) override{
+        data_.insert(data_.end(), data, data + size);
+    }
+
+    void writeAt(uint64_t offset, const std::vector<unsigned char> &data) override{
+        if(data_.size() < offset + data.size()) {
+            data_.resize(offset + data.size());
+        }
+        std::copy(data.begin(), data.end(), data_.begin() + static_cast<long>(offset));
+    }
+
+    void resize(uint64_t size) override{
+        data_.resize(size);
     }
 
     const std::vector<diff::ubyte_t> & data() const { return data_; }
@@ -229,8 +291,8 @@ TEST_CASE( "Delta serialization and deserialization", "[delta]" ) {
     delta.block_size = 4;
     delta.deletes[0] = 1;
     delta.deletes[1] = 1;
-    delta.inserts[0] = std::vector<diff::ubyte_t>(12, 0xFA);
-    delta.inserts[1] = std::vector<diff::ubyte_t>(12, 0xFB);
+    delta.inserts[0] = std::pmr::vector<diff::ubyte_t>(12, 0xFA);
+    delta.inserts[1] = std::pmr::vector<diff::ubyte_t>(12, 0xFB);
     std::vector<diff::ubyte_t> delta_buff = delta.serialize();
 
     diff::Delta delta2;
@@ -243,6 +305,24 @@ TEST_CASE( "Delta serialization and deserialization", "[delta]" ) {
     REQUIRE(delta.inserts[1] == delta2.inserts[1]);
 }
 
+// Serialized bytes cut to size, size prefix rewritten so the cut is found by the reads past it
+static std::vector<diff::ubyte_t> truncated(const std::vector<diff::ubyte_t> &bytes, size_t size) {
+    std::vector<diff::ubyte_t> cut(bytes.begin(), bytes.begin() + size);
+    if (size >= sizeof(size_t)) {
+        for (size_t i = 0; i < sizeof(size_t); i++) {
+            cut[i] = static_cast<diff::ubyte_t>((size - sizeof(size_t)) >> ((sizeof(size_t) - i - 1) * 8));
+        }
+    }
+    return cut;
+}
+
+// Overwrites length field at offset, big endian as written by generic_push_back
+static void setLength(std::vector<diff::ubyte_t> &bytes, size_t offset, uint64_t length) {
+    for (size_t i = 0; i < sizeof(length); i++) {
+        bytes[offset + i] = static_cast<diff::ubyte_t>(length >> ((sizeof(length) - i - 1) * 8));
+    }
+}
+
 TEST_CASE( "Delta deserialization throw", "[delta]" ) {
 
 
@@ -251,13 +331,76 @@ TEST_CASE( "Delta deserialization throw", "[delta]" ) {
     std::vector<diff::ubyte_t> delta_buff = {0,0,0,0,0,0,0,1};
 
     REQUIRE_THROWS(delta.deserialize(delta_buff));
+
+    // instruction type byte other than copy or literal
+    diff::Delta instructions;
+    instructions.format = diff::DeltaFormat::Instructions;
+    instructions.instructions.push_back({diff::Instruction::Type::Copy, 0x0102030405060708, 16});
+    std::vector<diff::ubyte_t> bytes = instructions.serialize();
+    std::vector<diff::ubyte_t> marker = {1, 2, 3, 4, 5, 6, 7, 8};
+    auto type = std::search(bytes.begin(), bytes.end(), marker.begin(), marker.end()) - 1;
+    REQUIRE_NOTHROW(diff::Delta().deserialize(bytes));
+    *type = 2;
+    REQUIRE_THROWS_AS(diff::Delta().deserialize(bytes), std::invalid_argument);
+}
+
+TEST_CASE( "Delta deserialization of truncated and oversized input", "[delta]" ) {
+    diff::Delta delta;
+    delta.sha = std::vector<diff::ubyte_t>(32, 7);
+    delta.block_size = 4;
+    delta.inserts[1] = {1, 2, 3};
+    delta.deletes[3] = 2;
+    delta.extensions[3] = {1, 2};
+    delta.addCopy(0, 8);
+    delta.addLiteral(delta.sha.data(), 5);
+    std::vector<diff::ubyte_t> bytes = delta.serialize();
+    REQUIRE_NOTHROW(diff::Delta().deserialize(bytes));
+
+    for (size_t size = 0; size < bytes.size(); size++) {
+        INFO("size " << size);
+        REQUIRE_THROWS_AS(diff::Delta().deserialize(truncated(bytes, size)), std::invalid_argument);
+    }
+
+    // size prefix, magic and version come before sha size
+    size_t sha_offset = sizeof(size_t) + sizeof(uint32_t) + sizeof(uint16_t);
+    std::vector<diff::ubyte_t> oversized = bytes;
+    setLength(oversized, sha_offset, 0x10000000);
+    REQUIRE_THROWS_AS(diff::Delta().deserialize(oversized), std::invalid_argument);
+    setLength(oversized, sha_offset, UINT64_MAX);
+    REQUIRE_THROWS_AS(diff::Delta().deserialize(oversized), std::invalid_argument);
+
+    // block size, chunking, format, compression and dictionary flag, then inserts count, index and size
+    size_t insert_offset = sha_offset + sizeof(size_t) + delta.sha.size() + sizeof(uint32_t) + 4 +
+                           sizeof(size_t) + sizeof(uint64_t);
+    oversized = bytes;
+    setLength(oversized, insert_offset, UINT64_MAX - 4);
+    REQUIRE_THROWS_AS(diff::Delta().deserialize(oversized), std::invalid_argument);
+}
+
+TEST_CASE( "Delta deserialization of deletes patch can't walk", "[delta]" ) {
+    diff::Delta delta;
+    delta.block_size = 4;
+    delta.deletes[3] = 2;
+    REQUIRE_NOTHROW(diff::Delta().deserialize(delta.serialize()));
+
+    // zero block delete would never move patch past the block
+    delta.deletes[3] = 0;
+    REQUIRE_THROWS_WITH(diff::Delta().deserialize(delta.serialize()), "Delta deletes zero blocks!");
+
+    delta.deletes[3] = 2;
+    delta.block_size = 0;
+    REQUIRE_THROWS_WITH(diff::Delta().deserialize(delta.serialize()), "Block delta with zero block size!");
+    // instruction delta doesn't use block size
+    delta.deletes.clear();
+    delta.format = diff::DeltaFormat::Instructions;
+    REQUIRE_NOTHROW(diff::Delta().deserialize(delta.serialize()));
 }
 
 TEST_CASE( "Signature serialization and deserialization", "[signature]" ) {
     diff::Signature signature;
     signature.sha = std::vector<diff::ubyte_t>(32, 1);
     signature.block_size = 4;
-    std::unordered_map<uint64_t, uint32_t> map;
+    std::pmr::unordered_map<uint64_t, uint64_t> map;
     map[0] = 1;
     map[1] = 1;
     map[2] = 3;
@@ -286,6 +429,36 @@ TEST_CASE( "Signature deserialization throw", "[signature]" ) {
     REQUIRE_THROWS(signature.deserialize(signature_buff));
 }
 
+TEST_CASE( "Signature deserialization of truncated and oversized input", "[signature]" ) {
+    diff::Signature signature;
+    signature.sha = std::vector<diff::ubyte_t>(32, 7);
+    signature.block_size = 4;
+    signature.super_block_factor = 2;
+    signature.super_hashes = {11, 12};
+    signature.addSignature(1, 21, 0);
+    signature.addSignature(2, 22, 1);
+    signature.addSignature(2, 23, 2);
+    std::vector<diff::ubyte_t> bytes = signature.serialize();
+    REQUIRE_NOTHROW(diff::Signature().deserialize(bytes));
+
+    for (size_t size = 0; size < bytes.size(); size++) {
+        INFO("size " << size);
+        REQUIRE_THROWS_AS(diff::Signature().deserialize(truncated(bytes, size)), std::invalid_argument);
+    }
+
+    size_t sha_offset = sizeof(size_t) + sizeof(uint32_t) + sizeof(uint16_t);
+    std::vector<diff::ubyte_t> oversized = bytes;
+    setLength(oversized, sha_offset, 0x10000000);
+    REQUIRE_THROWS_AS(diff::Signature().deserialize(oversized), std::invalid_argument);
+
+    // block size, rolling hash, chunking, block count, file size and super block factor before super hashes
+    size_t super_offset = sha_offset + sizeof(size_t) + signature.sha.size() + sizeof(uint32_t) + 2 +
+                          2 * sizeof(uint64_t) + sizeof(uint32_t);
+    oversized = bytes;
+    setLength(oversized, super_offset, UINT64_MAX / 8 + 1);
+    REQUIRE_THROWS_AS(diff::Signature().deserialize(oversized), std::invalid_argument);
+}
+
 
 TEST_CASE( "Calculate block size", "[signature]" ) {
 
@@ -293,6 +466,12 @@ TEST_CASE( "Calculate block size", "[signature]" ) {
     uintmax_t file_size2 = 20;
     REQUIRE(io::FileReader::calculateBlockSize(file_size) == 4);
     REQUIRE(io::FileReader::calculateBlockSize(file_size2) == 8);
+    REQUIRE(io::FileReader::calculateBlockSize(uintmax_t{1} << 32) == 4096);
+    REQUIRE(io::FileReader::calculateBlockSize(uintmax_t{10} << 40) == 16 * 1024 * 1024);
+    REQUIRE(io::FileReader::calculateBlockSize(uintmax_t{1} << 60) == 64 * 1024 * 1024);
+    // empty and single byte inputs used to divide by zero block size
+    REQUIRE(io::FileReader::calculateBlockSize(0) == 1);
+    REQUIRE(io::FileReader::calculateBlockSize(1) == 1);
 }
 
 TEST_CASE( "Generate signature", "[signature]" ) {
@@ -713,8 +892,1419 @@ TEST_CASE( "Patch sha don't match", "[patch]" ) {
     REQUIRE_THROWS(diff::Diff::patchFile(delta, reader, writer, true, sha));
 }
 
+TEST_CASE( "Sha256 of split updates", "[patch]" ) {
+    const std::string abc = "abc";
+    const diff::sha256_t expected = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+    auto data = reinterpret_cast<const diff::ubyte_t *>(abc.data());
+
+    diff::Sha256 sha;
+    sha.update(data, 1);
+    sha.update(data + 1, 0);
+    sha.update(data + 1, 2);
+
+    REQUIRE(sha.finish() == expected);
+    REQUIRE(diff::Diff::calculateSha256(data, abc.size()) == expected);
+}
+
+static std::vector<diff::ubyte_t> makeNoiseBuf(size_t size, uint32_t seed)
+{
+    std::vector<diff::ubyte_t> buffer(size);
+    for (auto &byte : buffer) {
+        seed = seed * 1664525 + 1013904223;
+        byte = static_cast<diff::ubyte_t>(seed >> 24);
+    }
+    return buffer;
+}
+
+template<RollingHash H>
+static bool rollsToHashBuffer(const std::vector<diff::ubyte_t> &data, uint16_t block_size)
+{
+    H rhash(block_size);
+    for (size_t i = 0; i < data.size(); i++) {
+        char oldest = i >= block_size ? static_cast<char>(data[i - block_size]) : 0;
+        rhash.roll(oldest, static_cast<char>(data[i]));
+        size_t begin = (i + 1) > block_size ? (i + 1 - block_size) : 0;
+        std::vector<diff::ubyte_t> window(data.begin() + begin, data.begin() + i + 1);
+        if (rhash.hash() != H::hashBuffer(window)) return false;
+    }
+    return true;
+}
+
+TEST_CASE( "Rolling hash families roll to window hash", "[rhash]" ) {
+    std::vector<diff::ubyte_t> data = makeNoiseBuf(512, 7);
+
+    REQUIRE(rollsToHashBuffer<RHash>(data, 16));
+    REQUIRE(rollsToHashBuffer<RabinKarpHash>(data, 16));
+    REQUIRE(rollsToHashBuffer<BuzHash>(data, 16));
+    REQUIRE(rollsToHashBuffer<BuzHash>(data, 33));
+}
+
+TEST_CASE( "Rolling hash names", "[rhash]" ) {
+    REQUIRE(rollingHashFromString("rabin-karp") == RollingHashType::RabinKarp);
+    REQUIRE(rollingHashName(RollingHashType::BuzHash) == "buzhash");
+    REQUIRE_THROWS(rollingHashFromString("crc"));
+}
+
+TEST_CASE( "Signature serialization keeps rolling hash", "[signature]" ) {
+    diff::Signature signature;
+    signature.block_size = 4;
+    signature.rolling_hash = RollingHashType::BuzHash;
+    signature.addSignature(1, 2, 0);
+
+    diff::Signature signature2;
+    signature2.deserialize(signature.serialize());
+
+    REQUIRE(signature2.rolling_hash == RollingHashType::BuzHash);
+}
+
+TEST_CASE( "Delta and patch with every rolling hash", "[delta]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(64, 3);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.insert(new_buf.begin() + 10, {0xFF, 0x80, 0x7F});
+    new_buf.erase(new_buf.begin() + 40, new_buf.begin() + 44);
+
+    for (auto type : {RollingHashType::Adler, RollingHashType::RabinKarp, RollingHashType::BuzHash}) {
+        diff::Diff d;
+        MockReader base_reader(base_buf);
+        d.prepareSignatures(base_reader, false, type);
+
+        MockReader new_reader(new_buf);
+        d.prepareDelta(d.signature(), new_reader);
+
+        MockWriter writer;
+        MockReader patch_reader(base_buf);
+        diff::Diff::patchFile(d.delta(), patch_reader, writer);
+
+        REQUIRE(writer.data() == new_buf);
+        REQUIRE(d.delta().deletes.size() == 2);
+    }
+}
+
+static std::string writeTempFile(const std::string &name, const std::vector<diff::ubyte_t> &data)
+{
+    std::string file_path = (std::filesystem::temp_directory_path() / name).string();
+    io::FileWriter writer(file_path);
+    writer.append(data);
+    return file_path;
+}
+
+static std::vector<diff::ubyte_t> readTempFile(const std::string &file_path)
+{
+    io::FileReader reader(file_path);
+    return reader.getBuffer();
+}
+
+TEST_CASE( "FastCDC cut points", "[cdc]" ) {
+    FastCDC cdc(1000);
+    std::vector<diff::ubyte_t> data = makeNoiseBuf(64 * 1024, 11);
+
+    REQUIRE(cdc.avg_size() == 1024);
+    REQUIRE(cdc.min_size() == 256);
+    REQUIRE(cdc.max_size() == 8192);
+    REQUIRE(cdc.cutPoint(data.data(), 100) == 100);
+
+    // averages past 2^28 would round up out of 32 bits or wrap the max size
+    for (uint32_t avg_size : {(uint32_t{1} << 28) + 1, uint32_t{1} << 31, UINT32_MAX}) {
+        FastCDC large(avg_size);
+        REQUIRE(large.avg_size() == (uint32_t{1} << 28));
+        REQUIRE(large.max_size() == (uint32_t{1} << 31));
+    }
+
+    size_t offset = 0;
+    while (offset < data.size()) {
+        size_t length = cdc.cutPoint(data.data() + offset, data.size() - offset);
+        REQUIRE(length > 0);
+        REQUIRE(length <= cdc.max_size());
+        if (offset + length < data.size()) {
+            REQUIRE(length >= cdc.min_size());
+        }
+        offset += length;
+    }
+    REQUIRE(offset == data.size());
+}
+
+TEST_CASE( "Content defined chunking delta and patch", "[cdc]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(256 * 1024, 5);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    std::vector<diff::ubyte_t> insertion = makeNoiseBuf(100, 9);
+    new_buf.insert(new_buf.begin() + 50000, insertion.begin(), insertion.end());
+    new_buf.erase(new_buf.begin() + 150000, new_buf.begin() + 150300);
+
+    std::string base_path = writeTempFile("jdiff_cdc_base", base_buf);
+    std::string new_path = writeTempFile("jdiff_cdc_new", new_buf);
+    std::string out_path = (std::filesystem::temp_directory_path() / "jdiff_cdc_out").string();
+
+    diff::Diff d;
+    io::FileReader base_reader(base_path, 1024, io::Chunking::ContentDefined);
+    d.prepareSignatures(base_reader);
+    REQUIRE(d.signature().chunking == io::Chunking::ContentDefined);
+
+    diff::Signature signature;
+    diff::Signature prepared = d.signature();
+    signature.deserialize(prepared.serialize());
+    REQUIRE(signature.chunking == io::Chunking::ContentDefined);
+    REQUIRE(signature.block_count == d.signature().block_count);
+
+    io::FileReader new_reader(new_path, signature.block_size, signature.chunking);
+    d.prepareDelta(signature, new_reader);
+
+    size_t literal_bytes = 0;
+    for (const auto &[index, bytes] : d.delta().inserts) {
+        literal_bytes += bytes.size();
+    }
+    REQUIRE(literal_bytes < 4 * 8192);
+
+    diff::Delta delta;
+    diff::Delta prepared_delta = d.delta();
+    delta.deserialize(prepared_delta.serialize());
+    REQUIRE(delta.chunking == io::Chunking::ContentDefined);
+    {
+        io::FileReader patch_reader(base_path, delta.block_size, delta.chunking);
+        io::FileWriter writer(out_path);
+        diff::Diff::patchFile(delta, patch_reader, writer);
+    }
+
+    REQUIRE(readTempFile(out_path) == new_buf);
+}
+
+class CountingReader : public io::FileReader {
+public:
+    CountingReader(const std::string &file_path, uint16_t block_size) : io::FileReader(file_path, block_size) {}
+
+    bool rollByte() override {
+        rolled_bytes++;
+        return io::FileReader::rollByte();
+    }
+
+    using io::FileReader::peek;
+    void peek(size_t length, std::vector<unsigned char> &data) override {
+        max_peek = std::max(max_peek, length);
+        io::FileReader::peek(length, data);
+    }
+
+    size_t rolled_bytes = 0;
+    size_t max_peek = 0;
+};
+
+TEST_CASE( "Signature super-block hashes", "[signature]" ) {
+    diff::Diff d;
+    std::vector<diff::ubyte_t> basic_buffer = makeBasicBuf();
+
+    MockReader reader(basic_buffer);
+    d.prepareSignatures(reader, false, RollingHashType::Adler, 2);
+
+    diff::Signature signature = d.signature();
+    REQUIRE(signature.super_block_factor == 2);
+    REQUIRE(signature.super_hashes.size() == 2);
+    REQUIRE(signature.super_hashes[1] == XXHash64::hash(&basic_buffer[8], 2 * s_block_size, 0));
+
+    diff::Signature signature2;
+    signature2.deserialize(signature.serialize());
+    REQUIRE(signature2.super_block_factor == 2);
+    REQUIRE(signature2.super_hashes == signature.super_hashes);
+
+    // super-block past the size cap turns skipping off
+    MockReader large_reader(basic_buffer);
+    d.prepareSignatures(large_reader, false, RollingHashType::Adler, UINT32_MAX);
+    REQUIRE(d.signature().super_block_factor == 0);
+    REQUIRE(d.signature().super_hashes.empty());
+}
+
+TEST_CASE( "Delta skips unchanged super-blocks", "[delta]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(64 * 1024 + 10, 21);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf[40000] ^= 0xFF;
+
+    std::string base_path = writeTempFile("jdiff_super_base", base_buf);
+    std::string new_path = writeTempFile("jdiff_super_new", new_buf);
+
+    diff::Diff d;
+    io::FileReader base_reader(base_path, 64);
+    d.prepareSignatures(base_reader, false, RollingHashType::Adler, 16);
+    REQUIRE(d.signature().super_hashes.size() == 64);
+
+    CountingReader new_reader(new_path, 64);
+    d.prepareDelta(d.signature(), new_reader);
+
+    REQUIRE(new_reader.rolled_bytes < 2 * 1024);
+    REQUIRE(d.delta().deletes.size() == 1);
+    REQUIRE(d.delta().deletes.find(625)->second == 1);
+    REQUIRE(d.delta().inserts.find(625)->second.size() == 64);
+
+    std::string out_path = (std::filesystem::temp_directory_path() / "jdiff_super_out").string();
+    {
+        io::FileReader patch_reader(base_path, d.delta().block_size);
+        io::FileWriter writer(out_path);
+        diff::Diff::patchFile(d.delta(), patch_reader, writer);
+    }
+    REQUIRE(readTempFile(out_path) == new_buf);
+
+    // loaded signature with super-block past the cap is matched block by block, frame isn't grown to it
+    diff::Signature large = d.signature();
+    large.super_block_factor = 1 << 20;
+    diff::Diff large_d;
+    CountingReader large_reader(new_path, 64);
+    large_d.prepareDelta(large, large_reader);
+    REQUIRE(large_reader.max_peek == 64);
+    REQUIRE(large_d.delta().deletes == d.delta().deletes);
+    REQUIRE(large_d.delta().inserts == d.delta().inserts);
+}
+
+TEST_CASE( "Delta aligned fast path", "[delta]" ) {
+    diff::Diff d;
+    std::vector<diff::ubyte_t> modified_buf = makeBasicBuf();
+    modified_buf[9] = 0;
+
+    diff::Signature signature = prepareMockSignature();
+
+    MockReader reader(modified_buf);
+    d.prepareDelta(signature, reader);
+
+    diff::Delta delta = d.delta();
+    REQUIRE(reader.skipped_blocks == 3);
+    REQUIRE(delta.deletes.size() == 1);
+    REQUIRE(delta.deletes.find(2)->second == 1);
+    REQUIRE(delta.inserts.find(2)->second == std::pmr::vector<diff::ubyte_t>{3,0,3,3});
+}
+
+TEST_CASE( "Delta of repeated blocks", "[delta]" ) {
+    diff::Diff d;
+    std::vector<diff::ubyte_t> base_buf(20, 7);
+    std::vector<diff::ubyte_t> new_buf(18, 7);
+
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+    REQUIRE(d.signature().block_count == 5);
+    REQUIRE(d.signature().block_hashes.size() == 5);
+
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+
+    MockWriter writer;
+    MockReader patch_reader(base_buf);
+    diff::Diff::patchFile(d.delta(), patch_reader, writer);
+
+    REQUIRE(writer.data() == new_buf);
+    REQUIRE(d.delta().deletes.size() == 1);
+    REQUIRE(d.delta().deletes.find(4)->second == 1);
+}
+
+TEST_CASE( "Large block sizes and indexes serialization", "[delta]" ) {
+    uint64_t far_index = (uint64_t{1} << 40) + 3;
+
+    diff::Delta delta;
+    delta.block_size = 16 * 1024 * 1024;
+    delta.deletes[far_index] = far_index;
+    delta.inserts[far_index] = {1, 2, 3};
+
+    diff::Delta delta2;
+    delta2.deserialize(delta.serialize());
+    REQUIRE(delta2.block_size == delta.block_size);
+    REQUIRE(delta2.deletes[far_index] == far_index);
+    REQUIRE(delta2.inserts[far_index] == delta.inserts[far_index]);
+
+    diff::Signature signature;
+    signature.block_size = 16 * 1024 * 1024;
+    signature.signatures[1][2] = far_index;
+
+    diff::Signature signature2;
+    signature2.deserialize(signature.serialize());
+    REQUIRE(signature2.block_size == signature.block_size);
+    REQUIRE(signature2.signatures[1][2] == far_index);
+}
+
+TEST_CASE( "Versioned header", "[signature]" ) {
+    diff::Delta delta;
+    diff::Signature signature;
+    std::vector<diff::ubyte_t> delta_buff = delta.serialize();
+    std::vector<diff::ubyte_t> signature_buff = signature.serialize();
+
+    REQUIRE_THROWS(signature.deserialize(delta_buff));
+    REQUIRE_THROWS(delta.deserialize(signature_buff));
+
+    signature_buff[sizeof(size_t) + sizeof(uint32_t) + 1]++;
+    REQUIRE_THROWS_WITH(signature.deserialize(signature_buff), "Unsupported signature version 3!");
+}
+
+TEST_CASE( "Block size tuner sqrt heuristic", "[tuner]" ) {
+    REQUIRE(diff::BlockSizeTuner::sqrtBlockSize(uintmax_t{1} << 30) == 32768);
+    REQUIRE(diff::BlockSizeTuner::sqrtBlockSize(uintmax_t{1} << 20) == 1024);
+    REQUIRE(diff::BlockSizeTuner::sqrtBlockSize(1000) == 256);
+    REQUIRE(diff::BlockSizeTuner::sqrtBlockSize(8) == 4);
+
+    diff::BlockSizeTuner tuner(uintmax_t{1} << 30);
+    diff::BlockSizeEstimate estimate = tuner.tune();
+    REQUIRE(estimate.block_size == 32768);
+    REQUIRE(estimate.signature_bytes > 0);
+    REQUIRE(estimate.delta_bytes > 0);
+}
+
+TEST_CASE( "Block size tuner sample", "[tuner]" ) {
+    diff::Signature signature;
+    signature.block_size = 4096;
+    signature.block_count = 256 * 1024;
+
+    diff::Delta scattered;
+    scattered.block_size = 4096;
+    for (uint64_t i = 0; i < 20000; i++) {
+        scattered.inserts[i * 10] = std::pmr::vector<diff::ubyte_t>(4100, 0);
+        scattered.deletes[i * 10] = 1;
+    }
+
+    diff::Delta rare;
+    rare.block_size = 4096;
+    rare.inserts[100] = std::pmr::vector<diff::ubyte_t>(5000, 0);
+    rare.deletes[100] = 1;
+
+    diff::BlockSizeTuner scattered_tuner(uintmax_t{1} << 30);
+    scattered_tuner.sampleChanges(signature, scattered);
+    diff::BlockSizeTuner rare_tuner(uintmax_t{1} << 30);
+    rare_tuner.sampleChanges(signature, rare);
+
+    diff::BlockSizeEstimate scattered_estimate = scattered_tuner.tune();
+    diff::BlockSizeEstimate rare_estimate = rare_tuner.tune();
+    REQUIRE(scattered_estimate.block_size < rare_estimate.block_size);
+    REQUIRE(scattered_estimate.total() <= scattered_tuner.estimate(rare_estimate.block_size).total());
+
+    diff::Signature empty;
+    REQUIRE_THROWS(rare_tuner.sampleChanges(empty, rare));
+    rare.block_size = 1024;
+    REQUIRE_THROWS(rare_tuner.sampleChanges(signature, rare));
+}
+
+TEST_CASE( "Delta matches tail block of appended file", "[delta]" ) {
+    diff::Diff d;
+    std::vector<diff::ubyte_t> base_buf = makeBasicBuf();
+    base_buf.pop_back();
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.push_back(9);
+    new_buf.push_back(9);
+
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+    REQUIRE(d.signature().file_size == 19);
+    REQUIRE(d.signature().tailSize() == 3);
+
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+
+    diff::Delta delta = d.delta();
+    REQUIRE(delta.deletes.empty());
+    REQUIRE(delta.inserts.size() == 1);
+    REQUIRE(delta.inserts.find(5)->second == std::pmr::vector<diff::ubyte_t>{9,9});
+}
+
+TEST_CASE( "Delta matches tail block at end of input", "[delta]" ) {
+    diff::Diff d;
+    std::vector<diff::ubyte_t> base_buf = makeBasicBuf();
+    base_buf.pop_back();
+    std::vector<diff::ubyte_t> new_buf = {1,1,1,1,2,2,2,2,7,5,5,5};
+
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+
+    diff::Delta delta = d.delta();
+    REQUIRE(delta.deletes.size() == 1);
+    REQUIRE(delta.deletes.find(2)->second == 2);
+    REQUIRE(delta.inserts.size() == 1);
+    REQUIRE(delta.inserts.find(2)->second == std::pmr::vector<diff::ubyte_t>{7});
+
+    MockWriter writer;
+    MockReader patch_reader(base_buf);
+    diff::Diff::patchFile(delta, patch_reader, writer);
+    REQUIRE(writer.data() == new_buf);
+}
+
+TEST_CASE( "Extend matches around small edits", "[delta]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(64, 13);
+    base_buf.pop_back();
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf[21] ^= 0xFF;
+    new_buf.insert(new_buf.begin() + 42, {0xAA, 0xBB});
+    new_buf[new_buf.size() - 2] ^= 0xFF;
+
+    diff::Diff d;
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+
+    MockReader extend_reader(base_buf);
+    d.extendMatches(extend_reader);
+
+    diff::Delta delta;
+    diff::Delta prepared_delta = d.delta();
+    delta.deserialize(prepared_delta.serialize());
+
+    size_t literal_bytes = 0;
+    for (const auto &[index, bytes] : delta.inserts) {
+        literal_bytes += bytes.size();
+    }
+    REQUIRE(literal_bytes == 4);
+    REQUIRE(delta.extensions.size() == 3);
+    REQUIRE(delta.extensions[5].head == 1);
+    REQUIRE(delta.extensions[5].tail == 2);
 
+    MockWriter writer;
+    MockReader patch_reader(base_buf);
+    diff::Diff::patchFile(delta, patch_reader, writer);
+    REQUIRE(writer.data() == new_buf);
+}
+
+TEST_CASE( "Delta instructions serialization", "[delta]" ) {
+    diff::Delta delta;
+    delta.format = diff::DeltaFormat::Instructions;
+    delta.addCopy(100, 20);
+    delta.addCopy(120, 5);
+    delta.addLiteral(std::vector<diff::ubyte_t>(3, 0xAB).data(), 3);
+    delta.addLiteral(std::vector<diff::ubyte_t>(2, 0xCD).data(), 2);
+    delta.addCopy(7, 9);
+
+    REQUIRE(delta.instructions.size() == 3);
 
+    diff::Delta delta2;
+    delta2.deserialize(delta.serialize());
+
+    REQUIRE(delta2.format == diff::DeltaFormat::Instructions);
+    REQUIRE(delta2.instructions.size() == 3);
+    REQUIRE(delta2.instructions[0].type == diff::Instruction::Type::Copy);
+    REQUIRE(delta2.instructions[0].offset == 100);
+    REQUIRE(delta2.instructions[0].length == 25);
+    REQUIRE(delta2.instructions[1].type == diff::Instruction::Type::Literal);
+    REQUIRE(delta2.instructions[1].length == 5);
+    REQUIRE(delta2.instructions[2].offset == 7);
+    REQUIRE(delta2.literals == std::vector<diff::ubyte_t>{0xAB, 0xAB, 0xAB, 0xCD, 0xCD});
+}
+
+TEST_CASE( "Direct diff of moved and edited regions", "[direct]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(4000, 17);
+    std::vector<diff::ubyte_t> new_buf(base_buf.begin() + 2501, base_buf.begin() + 3700);
+    new_buf.insert(new_buf.end(), {1, 2, 3});
+    new_buf.insert(new_buf.end(), base_buf.begin() + 13, base_buf.begin() + 2000);
+    new_buf[1500] ^= 0xFF;
+
+    std::string base_path = writeTempFile("jdiff_direct_base.bin", base_buf);
+    std::string new_path = writeTempFile("jdiff_direct_new.bin", new_buf);
+
+    for (unsigned threads : {1u, 4u}) {
+        diff::Diff d;
+        io::FileReader base_reader(base_path);
+        io::FileReader new_reader(new_path);
+        d.prepareDirectDelta(base_reader, new_reader, false, threads);
+
+        diff::Delta delta;
+        diff::Delta prepared_delta = d.delta();
+        delta.deserialize(prepared_delta.serialize());
+
+        REQUIRE(delta.format == diff::DeltaFormat::Instructions);
+        REQUIRE(delta.literals.size() == 4);
+
+        MockWriter writer;
+        MockReader patch_reader(base_buf);
+        diff::Diff::patchFile(delta, patch_reader, writer);
+        REQUIRE(writer.data() == new_buf);
+    }
+
+    std::filesystem::remove(base_path);
+    std::filesystem::remove(new_path);
+}
 
+TEST_CASE( "Direct diff keeps short matches as literals", "[direct]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(4000, 23);
+    std::vector<diff::ubyte_t> new_buf = makeNoiseBuf(300, 29);
+    // match no longer than copy record and the literal record it splits off stays literal
+    const size_t short_length = 2 * diff::Instruction::s_encoded_size;
+    new_buf.insert(new_buf.begin() + 100, base_buf.begin() + 1000, base_buf.begin() + 1000 + short_length);
+    new_buf.insert(new_buf.end(), base_buf.begin() + 3000, base_buf.begin() + 3100);
 
+    std::string base_path = writeTempFile("jdiff_direct_short_base.bin", base_buf);
+    std::string new_path = writeTempFile("jdiff_direct_short_new.bin", new_buf);
 
+    diff::Diff d;
+    io::FileReader base_reader(base_path);
+    io::FileReader new_reader(new_path);
+    d.prepareDirectDelta(base_reader, new_reader, false, 1);
+
+    const diff::Delta &delta = d.delta();
+    REQUIRE(delta.instructions.size() == 2);
+    REQUIRE(delta.instructions[0].type == diff::Instruction::Type::Literal);
+    REQUIRE(delta.instructions[0].length == 300 + short_length);
+    REQUIRE(delta.instructions[1].type == diff::Instruction::Type::Copy);
+    REQUIRE(delta.instructions[1].offset == 3000);
+    REQUIRE(delta.instructions[1].length == 100);
+
+    MockWriter writer;
+    MockReader patch_reader(base_buf);
+    diff::Diff::patchFile(delta, patch_reader, writer);
+    REQUIRE(writer.data() == new_buf);
+
+    std::filesystem::remove(base_path);
+    std::filesystem::remove(new_path);
+}
+
+TEST_CASE( "Direct diff index built on parallel slices", "[direct]" ) {
+    // 1 MiB per slice, so MatchIndex keeps all 4 threads
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(4 << 20, 19);
+    std::vector<diff::ubyte_t> new_buf(base_buf.begin() + (3 << 20), base_buf.end());
+    new_buf.insert(new_buf.end(), {7, 8, 9});
+    new_buf.insert(new_buf.end(), base_buf.begin() + 100, base_buf.begin() + (2 << 20));
+
+    REQUIRE(diff::MatchIndex(base_buf, 4).size() == diff::MatchIndex(base_buf, 1).size());
+
+    std::string base_path = writeTempFile("jdiff_direct_big_base.bin", base_buf);
+    std::string new_path = writeTempFile("jdiff_direct_big_new.bin", new_buf);
+    std::vector<std::vector<diff::ubyte_t>> serialized;
+    for (unsigned threads : {1u, 4u}) {
+        diff::Diff d;
+        io::FileReader base_reader(base_path);
+        io::FileReader new_reader(new_path);
+        d.prepareDirectDelta(base_reader, new_reader, false, threads);
+        REQUIRE(d.delta().literals.size() == 3);
+        serialized.push_back(d.delta().serialize());
+
+        MockWriter writer;
+        MockReader patch_reader(base_buf);
+        diff::Diff::patchFile(d.delta(), patch_reader, writer);
+        REQUIRE(writer.data() == new_buf);
+    }
+    // slices start on stride boundaries, thread count doesn't change the result
+    REQUIRE(serialized[0] == serialized[1]);
+
+    std::filesystem::remove(base_path);
+    std::filesystem::remove(new_path);
+}
+
+TEST_CASE( "Delta compressed literals", "[compression]" ) {
+    std::string text;
+    for (int i = 0; i < 200; i++) {
+        text += "{\"id\": " + std::to_string(i) + ", \"name\": \"item\", \"tags\": [\"a\", \"b\"]}\n";
+    }
+
+    diff::Delta delta;
+    delta.block_size = 4;
+    delta.inserts[0] = std::pmr::vector<diff::ubyte_t>(text.begin(), text.end());
+    delta.inserts[3] = std::pmr::vector<diff::ubyte_t>(5, 0xFB);
+    delta.inserts[7] = {};
+    delta.deletes[1] = 2;
+    delta.addLiteral(delta.inserts[3].data(), 5);
+    size_t plain_size = delta.serialize().size();
+
+    for (auto compression : {diff::Compression::Zlib, diff::Compression::Zstd}) {
+        delta.compression = compression;
+        if (!diff::isCompressionAvailable(compression)) {
+            REQUIRE_THROWS(delta.serialize());
+            continue;
+        }
+        std::vector<diff::ubyte_t> delta_buff = delta.serialize();
+        REQUIRE(delta_buff.size() * 5 < plain_size);
+
+        diff::Delta delta2;
+        delta2.deserialize(delta_buff);
+        REQUIRE(delta2.compression == compression);
+        REQUIRE(delta2.inserts == delta.inserts);
+        REQUIRE(delta2.literals == delta.literals);
+        REQUIRE(delta2.deletes == delta.deletes);
+
+        delta_buff.resize(delta_buff.size() - 8);
+        diff::generic_push_front(delta_buff, delta_buff.size());
+        delta_buff.erase(delta_buff.begin() + 8, delta_buff.begin() + 16);
+        REQUIRE_THROWS(delta2.deserialize(delta_buff));
+    }
+}
+
+TEST_CASE( "Compressed delta sizes checked against payload", "[compression]" ) {
+    diff::Delta delta;
+    delta.block_size = 4;
+    delta.inserts[2] = std::pmr::vector<diff::ubyte_t>(100, 0xAB);
+    delta.addLiteral(delta.inserts[2].data(), 50);
+    // size prefix, magic, version, empty sha, block size, chunking, format, compression, dictionary flag,
+    // inserts count and index of the first insert come before its size
+    size_t bytes_size_offset = sizeof(size_t) + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(size_t) +
+                               sizeof(uint32_t) + 4 + sizeof(size_t) + sizeof(uint64_t);
+
+    for (auto compression : {diff::Compression::Zlib, diff::Compression::Zstd}) {
+        if (!diff::isCompressionAvailable(compression)) {
+            continue;
+        }
+        delta.compression = compression;
+        std::vector<diff::ubyte_t> bytes = delta.serialize();
+        REQUIRE_NOTHROW(diff::Delta().deserialize(bytes));
+
+        // rejected before anything is allocated for it
+        std::vector<diff::ubyte_t> oversized = bytes;
+        setLength(oversized, bytes_size_offset, uint64_t{1} << 32);
+        REQUIRE_THROWS_WITH(diff::Delta().deserialize(oversized), "Compressed literals are larger than their payload!");
+        setLength(oversized, bytes_size_offset, UINT64_MAX);
+        REQUIRE_THROWS_AS(diff::Delta().deserialize(oversized), std::invalid_argument);
+
+        // frame has to end exactly at the declared sizes
+        std::vector<diff::ubyte_t> longer = bytes;
+        setLength(longer, bytes_size_offset, 101);
+        REQUIRE_THROWS_AS(diff::Delta().deserialize(longer), std::invalid_argument);
+        std::vector<diff::ubyte_t> shorter = bytes;
+        setLength(shorter, bytes_size_offset, 99);
+        REQUIRE_THROWS_WITH(diff::Delta().deserialize(shorter), "Compressed literals are longer than declared!");
+    }
+}
+
+TEST_CASE( "Patch with compressed delta", "[compression]" ) {
+    diff::Compression compression = diff::defaultCompression();
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(64, 19);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.insert(new_buf.begin() + 20, 40, 'x');
+
+    diff::Diff d;
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+
+    diff::Delta prepared_delta = d.delta();
+    prepared_delta.compression = compression;
+    diff::Delta delta;
+    delta.deserialize(prepared_delta.serialize());
+
+    MockWriter writer;
+    MockReader patch_reader(base_buf);
+    diff::Diff::patchFile(delta, patch_reader, writer);
+    REQUIRE(writer.data() == new_buf);
+}
+
+TEST_CASE( "Delta literals compressed with base dictionary", "[compression]" ) {
+    diff::Compression compression = diff::defaultCompression();
+    if (compression == diff::Compression::None) {
+        return;
+    }
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(16 * 1024, 23);
+    std::vector<diff::ubyte_t> edited(base_buf.begin() + 4096, base_buf.begin() + 8192);
+    edited[100] ^= 0xFF;
+    edited.insert(edited.begin() + 2000, {1, 2, 3});
+
+    diff::Delta delta;
+    delta.block_size = 1024;
+    delta.compression = compression;
+    delta.inserts[4].assign(edited.begin(), edited.end());
+    delta.inserts[9] = {7};
+    delta.deletes[4] = 4;
+    delta.addCopy(0, 1000);
+    delta.addLiteral(edited.data(), 10);
+    delta.addCopy(5000, 10);
+    delta.addLiteral(edited.data(), edited.size());
+
+    size_t plain_compressed = delta.serialize().size();
+    delta.base_dictionary = true;
+    REQUIRE_THROWS(delta.serialize());
+
+    MockReader base_reader(base_buf);
+    std::vector<diff::ubyte_t> delta_buff = delta.serialize(&base_reader);
+    REQUIRE(delta_buff.size() * 4 < plain_compressed);
+
+    diff::Delta delta2;
+    REQUIRE_THROWS(delta2.deserialize(delta_buff));
+    delta2.deserialize(delta_buff, &base_reader);
+    REQUIRE(delta2.base_dictionary);
+    REQUIRE(delta2.inserts == delta.inserts);
+    REQUIRE(delta2.literals == delta.literals);
+
+    std::vector<diff::ubyte_t> other_base = base_buf;
+    other_base[4200] ^= 0xFF;
+    MockReader other_reader(other_base);
+    REQUIRE_THROWS(delta2.deserialize(delta_buff, &other_reader));
+}
+
+TEST_CASE( "Compose chain of deltas", "[compose]" ) {
+    std::vector<diff::ubyte_t> v0 = makeNoiseBuf(70, 29);
+    std::vector<diff::ubyte_t> v1 = v0;
+    v1.insert(v1.begin() + 10, {0xAA, 0xBB, 0xCC});
+    v1.erase(v1.begin() + 40, v1.begin() + 48);
+    std::vector<diff::ubyte_t> v2 = v1;
+    v2[5] ^= 0xFF;
+    v2.insert(v2.end(), v0.begin(), v0.begin() + 20);
+    std::vector<diff::ubyte_t> v3(v2.begin() + 30, v2.end());
+    v3.push_back(0x11);
+
+    std::vector<std::vector<diff::ubyte_t>> versions = {v0, v1, v2, v3};
+    std::vector<diff::Delta> deltas;
+    for (size_t i = 0; i + 1 < versions.size(); i++) {
+        diff::Diff d;
+        MockReader base_reader(versions[i]);
+        d.prepareSignatures(base_reader);
+        MockReader new_reader(versions[i + 1]);
+        d.prepareDelta(d.signature(), new_reader);
+        if (i == 1) {
+            MockReader extend_reader(versions[i]);
+            d.extendMatches(extend_reader);
+        }
+        deltas.push_back(d.delta());
+    }
+
+    diff::Diff d;
+    d.composeDeltas(deltas, v0.size());
+    REQUIRE(d.delta().format == diff::DeltaFormat::Instructions);
+    REQUIRE(diff::Diff::outputSize(d.delta()) == v3.size());
+
+    MockWriter writer;
+    MockReader patch_reader(v0);
+    diff::Diff::patchFile(d.delta(), patch_reader, writer);
+    REQUIRE(writer.data() == v3);
+
+    std::vector<diff::Delta> broken = {deltas[0], deltas[2]};
+    broken[1] = diff::Diff::toInstructions(broken[1], v2.size());
+    broken[1].addCopy(1000, 1);
+    REQUIRE_THROWS(d.composeDeltas(broken, v0.size()));
+}
+
+TEST_CASE( "Reverse delta recorded by patch", "[patch]" ) {
+    std::vector<diff::ubyte_t> old_buf = makeNoiseBuf(66, 31);
+    std::vector<diff::ubyte_t> new_buf = old_buf;
+    new_buf[9] ^= 0xFF;
+    new_buf.erase(new_buf.begin() + 24, new_buf.begin() + 36);
+    new_buf.insert(new_buf.begin() + 40, {0xAB, 0xCD});
+
+    diff::Diff d;
+    MockReader base_reader(old_buf);
+    d.prepareSignatures(base_reader);
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+    MockReader extend_reader(old_buf);
+    d.extendMatches(extend_reader);
+
+    diff::Delta instructions = diff::Diff::toInstructions(d.delta(), old_buf.size());
+    instructions.addCopy(2, 30);
+
+    for (const diff::Delta &delta : {d.delta(), instructions}) {
+        diff::Delta reverse;
+        MockWriter writer;
+        MockReader patch_reader(old_buf);
+        diff::Diff::patchFile(delta, patch_reader, writer, false, {}, &reverse);
+        std::vector<diff::ubyte_t> patched = writer.data();
+
+        std::string patched_path = writeTempFile("jdiff_reverse_new.bin", patched);
+        REQUIRE(reverse.sha == diff::Diff::calculateFileSha256(patched_path));
+        std::filesystem::remove(patched_path);
+
+        diff::Delta reverse_read;
+        reverse_read.deserialize(reverse.serialize());
+        REQUIRE(reverse_read.literals.size() < old_buf.size() / 2);
+
+        MockWriter rollback_writer;
+        MockReader rollback_reader(patched);
+        diff::Diff::patchFile(reverse_read, rollback_reader, rollback_writer);
+        REQUIRE(rollback_writer.data() == old_buf);
+    }
+}
+
+TEST_CASE( "Patched view reads ranges", "[view]" ) {
+    std::vector<diff::ubyte_t> old_buf = makeNoiseBuf(90, 37);
+    std::vector<diff::ubyte_t> new_buf = old_buf;
+    new_buf.insert(new_buf.begin() + 13, {1, 2, 3, 4, 5});
+    new_buf.erase(new_buf.begin() + 50, new_buf.begin() + 61);
+    new_buf.insert(new_buf.end(), old_buf.begin(), old_buf.begin() + 9);
+
+    diff::Diff d;
+    MockReader base_reader(old_buf);
+    d.prepareSignatures(base_reader);
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+
+    MockReader view_reader(old_buf);
+    diff::PatchedView view(d.delta(), view_reader, old_buf.size());
+    REQUIRE(view.size() == new_buf.size());
+
+    for (uint64_t offset = 0; offset <= new_buf.size(); offset += 7) {
+        for (uint64_t length : {0, 1, 6, 30}) {
+            uint64_t end = std::min<uint64_t>(new_buf.size(), offset + length);
+            std::vector<diff::ubyte_t> expected(new_buf.begin() + static_cast<long>(offset),
+                                                new_buf.begin() + static_cast<long>(end));
+            REQUIRE(view.read(offset, length) == expected);
+        }
+    }
+    REQUIRE(view.read(new_buf.size() + 5, 10).empty());
+}
+
+TEST_CASE( "Patch selected ranges into sparse output", "[view]" ) {
+    std::vector<diff::ubyte_t> old_buf = makeNoiseBuf(64, 41);
+    std::vector<diff::ubyte_t> new_buf = old_buf;
+    new_buf.insert(new_buf.begin() + 30, {9, 8, 7});
+
+    diff::Diff d;
+    MockReader base_reader(old_buf);
+    d.prepareSignatures(base_reader);
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+
+    MockReader view_reader(old_buf);
+    diff::PatchedView view(d.delta(), view_reader, old_buf.size());
+    MockWriter writer;
+    view.writeRanges({{0, 5}, {28, 6}, {60, 100}}, writer);
+
+    std::vector<diff::ubyte_t> expected(new_buf.size(), 0);
+    std::copy(new_buf.begin(), new_buf.begin() + 5, expected.begin());
+    std::copy(new_buf.begin() + 28, new_buf.begin() + 34, expected.begin() + 28);
+    std::copy(new_buf.begin() + 60, new_buf.end(), expected.begin() + 60);
+    REQUIRE(writer.data() == expected);
+
+    // lengths that would wrap past 2^64 are clamped to the end of patched file
+    MockWriter wrapping_writer;
+    view.writeRanges({{28, UINT64_MAX}, {UINT64_MAX, 2}}, wrapping_writer);
+    expected.assign(new_buf.size(), 0);
+    std::copy(new_buf.begin() + 28, new_buf.end(), expected.begin() + 28);
+    REQUIRE(wrapping_writer.data() == expected);
+    REQUIRE(view.read(60, UINT64_MAX) == std::vector<diff::ubyte_t>(new_buf.begin() + 60, new_buf.end()));
+
+    // real file is resized to full size, unwritten ranges read back as zeros
+    std::string sparse_path = (std::filesystem::temp_directory_path() / "jdiff_sparse_out").string();
+    {
+        io::FileWriter file_writer(sparse_path);
+        view.writeRanges({{0, 5}, {28, 6}}, file_writer);
+    }
+    expected.assign(new_buf.size(), 0);
+    std::copy(new_buf.begin(), new_buf.begin() + 5, expected.begin());
+    std::copy(new_buf.begin() + 28, new_buf.begin() + 34, expected.begin() + 28);
+    REQUIRE(std::filesystem::file_size(sparse_path) == new_buf.size());
+    REQUIRE(readTempFile(sparse_path) == expected);
+    std::filesystem::remove(sparse_path);
+}
+
+TEST_CASE( "Memory and mapped readers give the same delta", "[reader]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(20000, 53);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.insert(new_buf.begin() + 5000, {7, 7, 7});
+    new_buf.erase(new_buf.begin() + 12000, new_buf.begin() + 13000);
+    std::string base_path = writeTempFile("jdiff_reader_base.bin", base_buf);
+    std::string new_path = writeTempFile("jdiff_reader_new.bin", new_buf);
+
+    for (io::Chunking chunking : {io::Chunking::Fixed, io::Chunking::ContentDefined}) {
+        diff::Diff file_diff;
+        io::FileReader file_base(base_path, 1024, chunking);
+        file_diff.prepareSignatures(file_base, true);
+        io::FileReader file_new(new_path, 1024, chunking);
+        file_diff.prepareDelta(file_diff.signature(), file_new, true);
+
+        diff::Diff memory_diff;
+        io::MemoryReader memory_base(base_buf, 1024, chunking);
+        memory_diff.prepareSignatures(memory_base, true);
+        io::MmapReader mapped_new(new_path, 1024, chunking);
+        memory_diff.prepareDelta(memory_diff.signature(), mapped_new, true);
+
+        REQUIRE(memory_diff.signature().sha == file_diff.signature().sha);
+        REQUIRE(memory_diff.signature().block_hashes == file_diff.signature().block_hashes);
+        REQUIRE(memory_diff.delta().inserts == file_diff.delta().inserts);
+        REQUIRE(memory_diff.delta().deletes == file_diff.delta().deletes);
+
+        std::vector<diff::ubyte_t> patched;
+        io::MemoryWriter writer(patched);
+        io::MmapReader patch_base(base_path, 1024, chunking);
+        diff::Diff::patchFile(memory_diff.delta(), patch_base, writer, true);
+        REQUIRE(patched == new_buf);
+    }
+
+    std::filesystem::remove(base_path);
+    std::filesystem::remove(new_path);
+}
+
+TEST_CASE( "Buffer API without files", "[api]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(50000, 59);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.insert(new_buf.begin() + 30000, 100, 0x42);
+    auto base = std::as_bytes(std::span<const diff::ubyte_t>(base_buf));
+    auto target = std::as_bytes(std::span<const diff::ubyte_t>(new_buf));
+    auto collect = [](std::vector<std::byte> &out) {
+        return [&out](std::span<const std::byte> data) { out.insert(out.end(), data.begin(), data.end()); };
+    };
+
+    diff::SignatureOptions options;
+    options.block_size = 1024;
+    options.sha = true;
+    std::vector<std::byte> signature_bytes;
+    diff::serializeSignature(diff::makeSignature(base, options), collect(signature_bytes));
+    diff::Signature signature = diff::deserializeSignature(signature_bytes);
+    REQUIRE(signature.sha == diff::Diff::calculateSha256(base_buf.data(), base_buf.size()));
+
+    std::vector<std::byte> delta_bytes;
+    diff::serializeDelta(diff::makeDelta(signature, target, true), collect(delta_bytes));
+    diff::Delta delta = diff::deserializeDelta(delta_bytes);
+    REQUIRE(delta.inserts.size() == 1);
+
+    // output streams to the sink block by block
+    std::vector<std::byte> patched;
+    size_t pieces = 0;
+    diff::applyDelta(delta, base, [&](std::span<const std::byte> data) {
+        patched.insert(patched.end(), data.begin(), data.end());
+        pieces++;
+    }, true);
+    REQUIRE(pieces > 1);
+    REQUIRE(patched == std::vector<std::byte>(target.begin(), target.end()));
+
+    diff::Delta direct = diff::makeDirectDelta(base, target, true, 1);
+    REQUIRE(diff::applyDelta(direct, base, true) == patched);
+
+    // empty base, everything is literal
+    std::span<const std::byte> empty;
+    REQUIRE(diff::applyDelta(diff::makeDelta(diff::makeSignature(empty), target), empty) == patched);
+}
+
+TEST_CASE( "Batch runs manifest items in parallel", "[batch]" ) {
+    std::istringstream bad_arity("signature base\n");
+    REQUIRE_THROWS_AS(diff::parseManifest(bad_arity), std::invalid_argument);
+    std::istringstream bad_op("# comment\n\nmerge a b c\n");
+    REQUIRE_THROWS_AS(diff::parseManifest(bad_op), std::invalid_argument);
+    std::istringstream empty_op("\"\" a b\n");
+    REQUIRE_THROWS_AS(diff::parseManifest(empty_op), std::invalid_argument);
+    std::istringstream same_output("signature a out\ndiff a b ./out\n");
+    REQUIRE_THROWS_WITH(diff::parseManifest(same_output), "Manifest line 2 writes output ./out of line 1!");
+
+    const size_t files = 6;
+    std::vector<std::vector<diff::ubyte_t>> new_bufs;
+    std::string signatures, deltas, patches;
+    for (size_t i = 0; i < files; i++) {
+        std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(20000 + i * 5000, 70 + static_cast<uint32_t>(i));
+        std::vector<diff::ubyte_t> new_buf = base_buf;
+        new_buf.insert(new_buf.begin() + 7000, 50, 0x42);
+        std::string name = "jdiff_batch_" + std::to_string(i);
+        std::string base = writeTempFile(name + ".base", base_buf);
+        std::string target = writeTempFile(name + ".new", new_buf);
+        new_bufs.push_back(new_buf);
+
+        signatures += "signature " + base + " " + base + ".sig\n";
+        // odd items take the signature round trip, even ones the direct diff
+        deltas += i % 2 ? "delta " + base + ".sig " + target + " " + base + ".delta\n"
+                        : "diff " + base + " " + target + " " + base + ".delta\n";
+        patches += "patch \"" + base + "\" " + base + ".delta " + base + ".out\n";
+    }
+    // missing input fails its own item only
+    patches += "patch /nonexistent/jdiff_batch /nonexistent/delta /nonexistent/out\n";
+
+    diff::BatchOptions options;
+    options.threads = 4;
+    options.force = true;
+    options.sha = true;
+    // budget below any input, items run one at a time
+    options.io_budget = 1;
+    size_t reported = 0;
+    auto run = [&](const std::string &manifest) {
+        std::istringstream in(manifest);
+        return diff::runBatch(diff::parseManifest(in), options, [&](const diff::BatchItem &, const diff::BatchResult &) {
+            reported++;
+        });
+    };
+
+    for (const auto &result : run(signatures)) {
+        REQUIRE(result.ok);
+    }
+    options.io_budget = (256 << 20);
+    for (const auto &result : run(deltas)) {
+        REQUIRE(result.ok);
+        REQUIRE(result.bytes_written > 0);
+    }
+    std::vector<diff::BatchResult> results = run(patches);
+    REQUIRE(reported == 3 * files + 1);
+    REQUIRE(results.size() == files + 1);
+    for (size_t i = 0; i < files; i++) {
+        REQUIRE(results[i].ok);
+        std::string prefix = (std::filesystem::temp_directory_path() / ("jdiff_batch_" + std::to_string(i))).string();
+        REQUIRE(readTempFile(prefix + ".base.out") == new_bufs[i]);
+        for (const char *suffix : {".base", ".new", ".base.sig", ".base.delta", ".base.out"}) {
+            std::filesystem::remove(prefix + suffix);
+        }
+    }
+    REQUIRE_FALSE(results.back().ok);
+    REQUIRE(results.back().error.find("doesn't exist") != std::string::npos);
+}
+
+TEST_CASE( "Batch runs lines after the lines writing their inputs", "[batch]" ) {
+    std::istringstream later("delta a.sig b out.delta\nsignature a a.sig\n");
+    REQUIRE_THROWS_WITH(diff::parseManifest(later),
+                        "Manifest line 1 reads output a.sig of line 2 that doesn't run before it!");
+    std::istringstream itself("patch a ./out out\n");
+    REQUIRE_THROWS_AS(diff::parseManifest(itself), std::invalid_argument);
+
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(400000, 90);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.insert(new_buf.begin() + 150000, 300, 0x5A);
+    std::string base = writeTempFile("jdiff_batch_chain.base", base_buf);
+    std::string target = writeTempFile("jdiff_batch_chain.new", new_buf);
+    std::string prefix = (std::filesystem::temp_directory_path() / "jdiff_batch_chain").string();
+    for (const char *suffix : {".sig", ".delta", ".out", ".missing.delta", ".missing.out"}) {
+        std::filesystem::remove(prefix + suffix);
+    }
+
+    // signature, the delta from it and the patch from that delta in one manifest
+    std::istringstream manifest("signature " + base + " " + prefix + ".sig\n" +
+                                "delta " + prefix + ".sig " + target + " " + prefix + ".delta\n" +
+                                "patch " + base + " " + prefix + ".delta " + prefix + ".out\n" +
+                                "diff /nonexistent/jdiff_batch " + target + " " + prefix + ".missing.delta\n" +
+                                "patch " + base + " " + prefix + ".missing.delta " + prefix + ".missing.out\n");
+    diff::BatchOptions options;
+    options.threads = 4;
+    options.sha = true;
+    std::vector<diff::BatchResult> results = diff::runBatch(diff::parseManifest(manifest), options);
+
+    for (size_t i = 0; i < 3; i++) {
+        REQUIRE(results[i].ok);
+    }
+    REQUIRE(readTempFile(prefix + ".out") == new_buf);
+    REQUIRE_FALSE(results[3].ok);
+    REQUIRE(results[4].error == "Input " + prefix + ".missing.delta of line 4 failed!");
+
+    for (const auto &path : {base, target, prefix + ".sig", prefix + ".delta", prefix + ".out"}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE( "Batch doesn't overwrite existing output", "[batch]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(20000, 80);
+    std::vector<diff::ubyte_t> existing = {1, 2, 3};
+    std::string base = writeTempFile("jdiff_batch_keep.base", base_buf);
+    std::string output = writeTempFile("jdiff_batch_keep.sig", existing);
+    std::string fresh = (std::filesystem::temp_directory_path() / "jdiff_batch_keep.fresh").string();
+    std::string failed = (std::filesystem::temp_directory_path() / "jdiff_batch_keep.failed").string();
+    std::filesystem::remove(fresh);
+    std::filesystem::remove(failed);
+
+    std::istringstream manifest("signature " + base + " " + output + "\nsignature " + base + " " + fresh +
+                                "\nsignature /nonexistent/jdiff_batch " + failed + "\n");
+    diff::BatchOptions options;
+    options.threads = 2;
+    std::vector<diff::BatchResult> results = diff::runBatch(diff::parseManifest(manifest), options, {});
+
+    REQUIRE_FALSE(results[0].ok);
+    REQUIRE(results[0].error == "Output " + output + " already exists, use -f!");
+    REQUIRE(readTempFile(output) == existing);
+    REQUIRE(results[1].ok);
+    REQUIRE(std::filesystem::file_size(fresh) > 0);
+    // output reserved for failed item is removed again
+    REQUIRE_FALSE(results[2].ok);
+    REQUIRE_FALSE(std::filesystem::exists(failed));
+
+    for (const auto &path : {base, output, fresh}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE( "C API signature, delta and patch", "[capi]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(30000, 61);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.erase(new_buf.begin() + 1000, new_buf.begin() + 3000);
+    new_buf[20000] ^= 0xFF;
+    REQUIRE(jdiff_abi_version() == JDIFF_ABI_VERSION);
+
+    jdiff_signature *built = jdiff_signature_create(1024, JDIFF_FLAG_SHA);
+    // fed in uneven pieces
+    for (size_t offset = 0; offset < base_buf.size(); offset += 7000) {
+        REQUIRE(jdiff_signature_feed(built, base_buf.data() + offset,
+                                     std::min<size_t>(7000, base_buf.size() - offset)) == JDIFF_OK);
+    }
+    REQUIRE(jdiff_signature_finish(built) == JDIFF_OK);
+    REQUIRE(jdiff_signature_feed(built, base_buf.data(), 1) == JDIFF_INVALID_STATE);
+
+    size_t size = 0;
+    REQUIRE(jdiff_signature_serialize(built, nullptr, 0, &size) == JDIFF_BUFFER_TOO_SMALL);
+    std::vector<diff::ubyte_t> signature_bytes(size);
+    REQUIRE(jdiff_signature_serialize(built, signature_bytes.data(), size, &size) == JDIFF_OK);
+    jdiff_signature_free(built);
+    jdiff_signature *signature = jdiff_signature_load(signature_bytes.data(), signature_bytes.size());
+    REQUIRE(signature != nullptr);
+
+    jdiff_delta *delta = jdiff_delta_create(signature);
+    jdiff_signature_free(signature);
+    REQUIRE(jdiff_delta_feed(delta, new_buf.data(), new_buf.size()) == JDIFF_OK);
+    REQUIRE(jdiff_delta_finish(delta) == JDIFF_OK);
+
+    std::vector<diff::ubyte_t> patched(new_buf.size() - 1);
+    REQUIRE(jdiff_patch(delta, base_buf.data(), base_buf.size(), JDIFF_FLAG_SHA, patched.data(), patched.size(),
+                        &size) == JDIFF_BUFFER_TOO_SMALL);
+    REQUIRE(size == new_buf.size());
+    patched.resize(size);
+    REQUIRE(jdiff_patch(delta, base_buf.data(), base_buf.size(), JDIFF_FLAG_SHA, patched.data(), patched.size(),
+                        &size) == JDIFF_OK);
+    REQUIRE(patched == new_buf);
+
+    std::vector<diff::ubyte_t> other_base = base_buf;
+    other_base[0] ^= 1;
+    REQUIRE(jdiff_patch(delta, other_base.data(), other_base.size(), JDIFF_FLAG_SHA, patched.data(), patched.size(),
+                        &size) == JDIFF_INVALID_ARGUMENT);
+    REQUIRE(std::string(jdiff_last_error()) == "Delta hash doesn't match to the base file!");
+    jdiff_delta_free(delta);
+
+    const char short_file[] = "JSIG";
+    REQUIRE(jdiff_signature_load(short_file, 4) == nullptr);
+    REQUIRE(std::string(jdiff_last_error()) == "Buffer is truncated!");
+    std::vector<diff::ubyte_t> oversized = signature_bytes;
+    oversized[14] = 0x10;
+    REQUIRE(jdiff_signature_load(oversized.data(), oversized.size()) == nullptr);
+    REQUIRE(std::string(jdiff_last_error()) == "Buffer is truncated!");
+    REQUIRE(jdiff_delta_load(oversized.data(), 12) == nullptr);
+
+    // null handles are bad arguments, not calls in wrong state
+    REQUIRE(jdiff_signature_serialize(nullptr, nullptr, 0, &size) == JDIFF_INVALID_ARGUMENT);
+    REQUIRE(jdiff_delta_serialize(nullptr, nullptr, 0, &size) == JDIFF_INVALID_ARGUMENT);
+    REQUIRE(jdiff_delta_create(nullptr) == nullptr);
+    REQUIRE(std::string(jdiff_last_error()) == "Signature is null!");
+    REQUIRE(jdiff_patch(nullptr, base_buf.data(), base_buf.size(), 0, nullptr, 0, &size) == JDIFF_INVALID_ARGUMENT);
+}
+
+TEST_CASE( "Stats count delta and patch work", "[stats]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(64, 41);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf[21] ^= 0xFF;
+
+    diff::Stats stats;
+    diff::Diff d;
+    d.setStats(&stats);
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+    REQUIRE(stats.count(diff::Stats::Counter::BlocksHashed) == 16);
+
+    diff::Stats delta_stats;
+    d.setStats(&delta_stats);
+    MockReader new_reader(new_buf);
+    d.prepareDelta(d.signature(), new_reader);
+    REQUIRE(delta_stats.count(diff::Stats::Counter::RollingPositions) > 0);
+    REQUIRE(delta_stats.count(diff::Stats::Counter::WeakHits) ==
+            delta_stats.count(diff::Stats::Counter::StrongHits) + delta_stats.count(diff::Stats::Counter::FalseWeakHits));
+    REQUIRE(delta_stats.count(diff::Stats::Counter::LiteralBytes) == s_block_size);
+    REQUIRE(delta_stats.count(diff::Stats::Counter::CopiedBlocks) == 15);
+
+    diff::Stats patch_stats;
+    MockWriter writer;
+    MockReader patch_reader(base_buf);
+    patch_reader.setStats(&patch_stats);
+    diff::Diff::patchFile(d.delta(), patch_reader, writer);
+    REQUIRE(writer.data() == new_buf);
+    REQUIRE(patch_stats.count(diff::Stats::Counter::BytesWritten) == new_buf.size());
+    REQUIRE(patch_stats.count(diff::Stats::Counter::LiteralBytes) == s_block_size);
+    REQUIRE(patch_stats.count(diff::Stats::Counter::CopiedBlocks) == 15);
+}
+
+TEST_CASE( "Stats of extended delta in one sink", "[stats]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(4096, 47);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    // one edited byte in block 10, two deleted bytes and one inserted in block 20
+    new_buf[10 * s_block_size + 1] ^= 0xFF;
+    new_buf.erase(new_buf.begin() + 20 * s_block_size + 2, new_buf.begin() + 20 * s_block_size + 4);
+    new_buf.insert(new_buf.begin() + 20 * s_block_size + 2, 0x42);
+
+    diff::Diff d;
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+
+    // stats only on Diff, readers have none
+    diff::Stats stats;
+    d.setStats(&stats);
+    io::MemoryReader new_reader(new_buf, s_block_size);
+    d.prepareDelta(d.signature(), new_reader);
+    io::MemoryReader extend_reader(base_buf, s_block_size);
+    d.extendMatches(extend_reader);
+    REQUIRE(new_reader.stats() == nullptr);
+    REQUIRE(extend_reader.stats() == nullptr);
+
+    uint64_t literal_bytes = 0;
+    for (const auto &[index, bytes] : d.delta().inserts) {
+        literal_bytes += bytes.size();
+    }
+    uint64_t extended_bytes = 0;
+    for (const auto &[index, extension] : d.delta().extensions) {
+        extended_bytes += extension.head + extension.tail;
+    }
+    REQUIRE(extended_bytes > 0);
+    REQUIRE(stats.count(diff::Stats::Counter::LiteralBytes) == literal_bytes);
+    REQUIRE(stats.count(diff::Stats::Counter::CopiedBytes) == extended_bytes);
+    // aligned skips hash blocks through the reader, base reads of extension are counted too
+    REQUIRE(stats.count(diff::Stats::Counter::BlocksHashed) >= base_buf.size() / s_block_size - 2);
+    REQUIRE(stats.count(diff::Stats::Counter::BytesRead) > new_buf.size());
+}
+
+TEST_CASE( "Steady state loops don't allocate", "[alloc]" ) {
+    // allocation count of a run has to be about the same for small and large file, while the large one has 16 times
+    // more blocks, rolled positions and patch instructions. Containers growing geometrically add a few.
+    static constexpr size_t s_small_size = 256 * 1024;
+    static constexpr size_t s_large_size = 4 * 1024 * 1024;
+    static constexpr uint64_t s_max_difference = 16;
+    std::string out_path = (std::filesystem::temp_directory_path() / "jdiff_alloc_out").string();
+
+    // same edits at the same relative positions of both sizes: edited byte, deleted block, 3 inserted bytes that
+    // shift the rest of the file and a run of new data 1/16 of the size long, which is rolled byte by byte
+    auto edit = [](const std::vector<diff::ubyte_t> &base) {
+        size_t size = base.size();
+        std::vector<diff::ubyte_t> edited(base.begin(), base.begin() + static_cast<long>(size * 3 / 4));
+        edited[size / 8 + 100] ^= 0xFF;
+        edited.erase(edited.begin() + static_cast<long>(size / 4), edited.begin() + static_cast<long>(size / 4 + 4096));
+        edited.insert(edited.begin() + static_cast<long>(size / 2), {1, 2, 3});
+        std::vector<diff::ubyte_t> fresh = makeNoiseBuf(size / 16, 53);
+        edited.insert(edited.end(), fresh.begin(), fresh.end());
+        edited.insert(edited.end(), base.begin() + static_cast<long>(size * 3 / 4), base.end());
+        return edited;
+    };
+
+    auto check = [&](auto run) {
+        uint64_t counts[2];
+        size_t sizes[2] = {s_small_size, s_large_size};
+        for (size_t i = 0; i < 2; i++) {
+            std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(sizes[i], 47);
+            std::string base_path = writeTempFile("jdiff_alloc_base.bin", base_buf);
+            std::string new_path = writeTempFile("jdiff_alloc_new.bin", edit(base_buf));
+
+            counts[i] = run(base_path, new_path);
+
+            std::filesystem::remove(base_path);
+            std::filesystem::remove(new_path);
+        }
+        INFO("allocations " << counts[0] << " -> " << counts[1]);
+        REQUIRE(counts[1] <= counts[0] + s_max_difference);
+    };
+
+    SECTION("signature") {
+        // every block is distinct, one map entry each
+        check([](const std::string &base_path, const std::string &) {
+            uint64_t before = s_allocations.load();
+            diff::Diff d;
+            io::FileReader reader(base_path, 4096);
+            d.prepareSignatures(reader);
+            uint64_t allocations = s_allocations.load() - before;
+            REQUIRE(d.signature().signatures.size() == d.signature().block_count);
+            return allocations;
+        });
+    }
+
+    SECTION("delta") {
+        // aligned blocks are skipped, shifted ones and new run are rolled byte by byte
+        check([](const std::string &base_path, const std::string &new_path) {
+            diff::Diff d;
+            io::FileReader base_reader(base_path, 4096);
+            d.prepareSignatures(base_reader);
+            diff::Signature signature = d.signature();
+
+            uint64_t before = s_allocations.load();
+            io::FileReader new_reader(new_path, 4096);
+            d.prepareDelta(signature, new_reader);
+            uint64_t allocations = s_allocations.load() - before;
+            REQUIRE(d.delta().inserts.size() >= 3);
+            REQUIRE_FALSE(d.delta().deletes.empty());
+            return allocations;
+        });
+    }
+
+    SECTION("patch") {
+        // block delta with inserts and deletes, and instruction delta of direct diff
+        check([&](const std::string &base_path, const std::string &new_path) {
+            diff::Diff d;
+            io::FileReader signature_reader(base_path, 4096);
+            d.prepareSignatures(signature_reader);
+            io::FileReader delta_reader(new_path, 4096);
+            d.prepareDelta(d.signature(), delta_reader);
+            diff::Delta block_delta = d.takeDelta();
+            io::FileReader direct_base_reader(base_path);
+            io::FileReader direct_new_reader(new_path);
+            d.prepareDirectDelta(direct_base_reader, direct_new_reader, false, 1);
+            diff::Delta instruction_delta = d.takeDelta();
+            REQUIRE(instruction_delta.instructions.size() >= 4);
+
+            uint64_t before = s_allocations.load();
+            for (const diff::Delta *delta : {&block_delta, &instruction_delta}) {
+                io::FileReader base_reader(base_path, delta->block_size);
+                io::FileWriter writer(out_path);
+                diff::Diff::patchFile(*delta, base_reader, writer);
+            }
+            uint64_t allocations = s_allocations.load() - before;
+            REQUIRE(readTempFile(out_path) == readTempFile(new_path));
+            return allocations;
+        });
+    }
+    std::filesystem::remove(out_path);
+}
+
+TEST_CASE( "Signature and delta nodes come from arena", "[alloc]" ) {
+    static constexpr uint64_t s_entries = 100000;
+
+    uint64_t before = s_allocations.load();
+    diff::Signature signature;
+    diff::Delta delta;
+    for (uint64_t i = 0; i < s_entries; i++) {
+        signature.addSignature(static_cast<uint32_t>(i), i * 7, i);
+        delta.inserts[i * 2] = {1, 2, 3};
+        delta.deletes[i * 2 + 1] = 1;
+    }
+    // pool chunks and bucket arrays only, not a node per entry
+    REQUIRE(s_allocations.load() - before < s_entries / 100);
+
+    diff::Signature signature_copy = signature;
+    diff::Signature signature_moved = std::move(signature_copy);
+    REQUIRE(signature_moved.countSignatures() == s_entries);
+    REQUIRE(signature_moved.signatures[42][42 * 7] == 42);
+
+    diff::Delta delta_copy = delta;
+    diff::Delta delta_moved;
+    delta_moved = std::move(delta_copy);
+    delta.clear();
+    REQUIRE(delta_moved.inserts.size() == s_entries);
+    REQUIRE(delta_moved.inserts[84] == std::pmr::vector<diff::ubyte_t>{1, 2, 3});
+    REQUIRE(delta_moved.deletes[85] == 1);
+}
+
+TEST_CASE( "Taken results don't share pool with reused Diff", "[alloc]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(64 * 1024, 61);
+    std::vector<diff::ubyte_t> new_buf = base_buf;
+    new_buf.insert(new_buf.begin() + 1000, 10, 0x42);
+
+    diff::Diff d;
+    io::MemoryReader base_reader(base_buf, 1024);
+    d.prepareSignatures(base_reader);
+    diff::Signature signature = d.takeSignature();
+    io::MemoryReader new_reader(new_buf, 1024);
+    d.prepareDelta(signature, new_reader);
+    diff::Delta delta = d.takeDelta();
+
+    auto pool = [](const auto &container) { return container.get_allocator().resource(); };
+    REQUIRE(pool(signature.signatures) != pool(d.signature().signatures));
+    REQUIRE(pool(delta.inserts) != pool(d.delta().inserts));
+
+    // Diff is reused on another thread while taken results are modified and read on this one
+    std::thread worker([&] {
+        io::MemoryReader reader(new_buf, 1024);
+        d.prepareSignatures(reader);
+        d.prepareDelta(d.signature(), reader);
+    });
+    for (uint32_t i = 0; i < 10000; i++) {
+        signature.addSignature(0x80000000u + i, i, 100000 + i);
+        delta.inserts[100000 + i] = {1};
+    }
+    worker.join();
+
+    REQUIRE(d.delta().inserts.empty());
+    delta.inserts.erase(delta.inserts.lower_bound(100000), delta.inserts.end());
+    MockWriter writer;
+    io::MemoryReader patch_reader(base_buf, 1024);
+    diff::Diff::patchFile(delta, patch_reader, writer);
+    REQUIRE(writer.data() == new_buf);
+}
+
+#ifdef JDIFF_WITH_TRACE
+TEST_CASE( "Trace records spans of a run", "[trace]" ) {
+    std::vector<diff::ubyte_t> base_buf = makeNoiseBuf(64, 43);
+    std::string trace_path = (std::filesystem::temp_directory_path() / "jdiff_trace.json").string();
+
+    diff::Tracer::instance().start(trace_path);
+    diff::Diff d;
+    MockReader base_reader(base_buf);
+    d.prepareSignatures(base_reader);
+    diff::Signature signature = d.signature();
+    signature.serialize();
+    diff::Tracer::instance().stop();
+    REQUIRE_FALSE(diff::Tracer::instance().enabled());
+
+    std::vector<diff::ubyte_t> trace = readTempFile(trace_path);
+    std::string json(trace.begin(), trace.end());
+    REQUIRE(json.rfind("{\"displayTimeUnit\"", 0) == 0);
+    REQUIRE(json.find("\"name\": \"prepareSignatures\"") != std::string::npos);
+    REQUIRE(json.find("\"name\": \"Signature::serialize\"") != std::string::npos);
+    REQUIRE(json.find("\"ph\": \"X\"") != std::string::npos);
+    std::filesystem::remove(trace_path);
+}
+#endif
@@ -0,0 +1,72 @@
+#include "trace.hpp"
+
+#include <unistd.h>
+#include <fstream>
+#include <stdexcept>
+
+namespace diff {
+    // small sequential ids read better in trace viewers than hashed std::thread::id
+    static uint32_t threadIndex() {
+        static std::atomic<uint32_t> s_next_thread = 0;
+        thread_local uint32_t index = s_next_thread++;
+        return index;
+    }
+
+    void Tracer::start(const std::string &file_path) {
+        std::ofstream os(file_path);
+        if (!os) {
+            throw std::invalid_argument(std::string("Can't write trace file " + file_path + "!"));
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_path_ = file_path;
+        events_.clear();
+        start_ = std::chrono::steady_clock::now();
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+
+    void Tracer::stop() {
+        if (!enabled()) {
+            return;
+        }
+        enabled_.store(false, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ofstream os(file_path_);
+        auto pid = static_cast<long>(getpid());
+        os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        for (size_t i = 0; i < events_.size(); i++) {
+            const Event &event = events_[i];
+            // timestamps and durations are microseconds
+            os << (i ? ",\n" : "\n") << "{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+               << "\", \"ph\": \"" << event.phase << "\", \"pid\": " << pid << ", \"tid\": " << event.thread
+               << ", \"ts\": " << event.timestamp_ns / 1000 << "." << event.timestamp_ns % 1000 / 100;
+            if (event.phase == 'X') {
+                os << ", \"dur\": " << event.value / 1000 << "." << event.value % 1000 / 100 << "}";
+            } else {
+                os << ", \"args\": {\"value\": " << event.value << "}}";
+            }
+        }
+        os << "\n]}" << std::endl;
+        events_.clear();
+    }
+
+    void Tracer::span(const char *name, const char *category, std::chrono::steady_clock::time_point begin,
+                      std::chrono::steady_clock::time_point end) {
+        Event event{name, category, 'X', threadIndex(), sinceStart(begin), sinceStart(end) - sinceStart(begin)};
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.push_back(event);
+    }
+
+    void Tracer::counter(const char *name, uint64_t value) {
+        Event event{name, "counter", 'C', threadIndex(), sinceStart(std::chrono::steady_clock::now()), value};
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.push_back(event);
+    }
+
+    uint64_t Tracer::sinceStart(std::chrono::steady_clock::time_point time) const {
+        if (time < start_) {
+            return 0;
+        }
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time - start_).count());
+    }
+}